@@ -12,6 +12,16 @@ typedef struct ConditionalCodes
     uint8_t cy : 1;
 } ConditionalCodes;
 
+struct State8080;
+
+// IN and OUT go to a handler per port, in a table the machine sets up
+// (machine.c); ports without one read as 0 and ignore what's written
+typedef struct PortTable
+{
+    uint8_t (*read[256])(struct State8080 *state, uint8_t port);
+    void (*write[256])(struct State8080 *state, uint8_t port, uint8_t value);
+} PortTable;
+
 typedef struct State8080
 {
     uint8_t a;
@@ -30,10 +40,36 @@ typedef struct State8080
 
     struct ConditionalCodes cc;
     uint8_t int_enabled; // interrupt enable
-    unsigned int cycles;
+    uint64_t cycles; // 64 bits: 32 would wrap after 36 minutes of game time
     // uint8_t *bus;
+
+    // called after every write to memory with the first address and the number of bytes
+    // written (VRAM tracking, watchpoints...), NULL if nobody is listening
+    void (*write_hook)(struct State8080 *state, uint16_t address, uint16_t length);
+
+    // the port handlers, and the state of the devices behind them for this
+    // machine (what it is is up to the handlers)
+    const PortTable *ports;
+    void *device;
+
+    // XOR of ByteHash(address, value) over the whole address space, kept up to
+    // date by WriteMemory when STATE_HASH is on (see HashMemory)
+    uint64_t memory_hash;
 } State8080;
 
+#if FOR_CPUDIAG
+#define MEMORY_SIZE 0x1453
+#else
+// 16KB (8KB ROM + 8KB RAM)
+#define MEMORY_SIZE 0x4000
+#endif
+
+// the whole 64KB the 8080 can address gets allocated (zeroed), so that the
+// game's stray accesses past MEMORY_SIZE (sprites at the bottom of the screen,
+// the read of $4050 in attract mode) land on defined bytes instead of whatever
+// follows on the heap
+#define ADDRESS_SPACE 0x10000
+
 void InitializeRegisters(State8080 *state)
 {
     state->a = 0x00;
@@ -46,23 +82,68 @@ void InitializeRegisters(State8080 *state)
     state->sp = 0x00;
     state->pc = 0x00;
     state->int_enabled = 0x00;
+    state->write_hook = NULL;
+    state->ports = NULL;
+    state->device = NULL;
+    state->memory_hash = 0;
 }
 
 void InitializeMemory(State8080 *state)
 {
-    if (!FOR_CPUDIAG)
+    state->memory = (uint8_t *)calloc(ADDRESS_SPACE, 1);
+}
+
+// splitmix64 finalizer: spreads every input bit over the whole result
+static inline uint64_t Mix64(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Zobrist-style hash of one byte of memory: a different random-looking 64 bit
+// value for each (address, value) pair, computed instead of stored in a table
+static inline uint64_t ByteHash(uint16_t address, uint8_t value)
+{
+    return Mix64((((uint64_t)address << 8) | value) + 0x9e3779b97f4a7c15ULL);
+}
+
+// XORs the bytes in [address, address + length) in or out of memory_hash.
+// Code that writes memory in bulk calls it before (out) and after (in)
+void HashMemoryRange(State8080 *state, uint16_t address, int length)
+{
+    int i;
+    for (i = 0; i < length; i++)
     {
-        // allocate memory for 16KB (8KB ROM + 8KB RAM)
-        state->memory = (uint8_t *)malloc(0x4000);
+        uint16_t at = address + i;
+        state->memory_hash ^= ByteHash(at, state->memory[at]);
     }
-    else
+}
+
+// memory_hash from scratch, after loading a ROM or anything else that
+// wrote memory directly
+void HashMemory(State8080 *state)
+{
+    state->memory_hash = 0;
+    HashMemoryRange(state, 0, ADDRESS_SPACE);
+}
+
+// All the writes of the core go through here so the write hook sees them
+static inline void WriteMemory(State8080 *state, uint16_t address, uint8_t value)
+{
+#if STATE_HASH
+    state->memory_hash ^= ByteHash(address, state->memory[address]) ^ ByteHash(address, value);
+#endif
+    state->memory[address] = value;
+
+    if (state->write_hook)
     {
-        state->memory = (uint8_t *)malloc(0x1453);
+        state->write_hook(state, address, 1);
     }
 }
 
-int stack_size = 0;
-int stack[100];
+MACHINE_LOCAL int stack_size = 0;
+MACHINE_LOCAL int stack[100];
 
 void ShowState(State8080 *state)
 {
@@ -98,21 +179,8 @@ void SetFlags(State8080 *state, uint16_t ops_result)
     state->cc.z = ((ops_result & 0xff) == 0) ? 1 : 0;
     state->cc.s = (ops_result >> 7 & 0x01 == 1) ? 1 : 0;
 
-    int i, count = 0;
-    // printf("Parity check: 0b");
-    for (i = 0; i < 8; i++)
-    {
-
-        if ((ops_result >> i & 0x01) == 1)
-        {
-            count++;
-            // printf("1");
-        } else {
-            // printf("0");
-        }
-    }
-        // printf("\n");
-    state->cc.p = (count % 2 == 0) ? 1 : 0;
+    // even number of bits set in the low byte
+    state->cc.p = !__builtin_parity(ops_result & 0xff);
 
     state->cc.ac = ((((ops_result & 0xF) - 1) & 0x10) == 0x10) ? 1 : 0;
 
@@ -125,6 +193,16 @@ void SetFlags(State8080 *state, uint16_t ops_result)
     state->cc.cy = (ops_result > 0xFF) ? 1 : 0;
 }
 
+// ADD/ADC/ADI/ACI: AC is the carry out of the low nibble, which the result
+// alone doesn't tell (DAA needs it right for the BCD score)
+void AddToAccumulator(State8080 *state, uint8_t value, uint8_t carry)
+{
+    uint16_t res = state->a + value + carry;
+    SetFlags(state, res);
+    state->cc.ac = ((state->a & 0x0f) + (value & 0x0f) + carry) > 0x0f;
+    state->a = res & 0xff;
+}
+
 void UnimplementedInstruction(State8080 *state)
 {
     uint8_t *opcode = &state->memory[state->pc];
@@ -140,17 +218,36 @@ void UnimplementedInstruction(State8080 *state)
     exit(1);
 }
 
-int Emulate8080(State8080 *state)
+// instruction size in bytes, indexed by opcode
+const uint8_t opcode_lengths[256] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,  // 00
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,  // 10
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,  // 20
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,  // 30
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 40
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 50
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 60
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 70
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 80
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 90
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // a0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // b0
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1,  // c0
+    1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 1, 2, 1,  // d0
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,  // e0
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,  // f0
+};
+
+// Executes one instruction whose opcode is already known.
+// Always inlined so that callers passing a constant opcode (fused handlers)
+// get only that case of the switch compiled in.
+static inline __attribute__((always_inline)) int Execute8080(State8080 *state, uint8_t op)
 {
     int opbytes = 1;
     uint8_t *opcode = &state->memory[state->pc];
     uint16_t address;
 
-    if (LOGS_CPU)
-    {
-        printf("Executing opcode: %02x, PC is %02x\n", *opcode, state->pc);
-    }
-    switch (*opcode)
+    switch (op)
     {
     case 0x00:
         opbytes = 1;
@@ -169,7 +266,7 @@ int Emulate8080(State8080 *state)
         // 0x02	STAX B	1		(BC) <- A
         {
             uint16_t bc = (state->b << 8) + (state->c);
-            state->memory[bc] = state->a;
+            WriteMemory(state, bc, state->a);
 
             state->cycles += 7;
             opbytes = 1;
@@ -330,7 +427,7 @@ int Emulate8080(State8080 *state)
     case 0x12:
         // 0x12	STAX D	1		(DE) <- A
         // store whatever is in A in memory with address [whatever is contained in DE]
-        state->memory[(state->d << 8) + (state->e)] = state->a;
+        WriteMemory(state, (state->d << 8) + (state->e), state->a);
         opbytes = 1;
         state->cycles += 7;
         break;
@@ -484,8 +581,8 @@ int Emulate8080(State8080 *state)
         // 0x22	SHLD adr	3		(adr) <-L; (adr+1)<-H
         {
             uint16_t adr = ((state->memory[state->pc + 2]) << 8) | (state->memory[state->pc + 1]);
-            state->memory[adr] = state->l;
-            state->memory[adr + 1] = state->h;
+            WriteMemory(state, adr, state->l);
+            WriteMemory(state, adr + 1, state->h);
 
             opbytes = 3;
             state->cycles += 16;
@@ -531,37 +628,34 @@ int Emulate8080(State8080 *state)
         break;
 
     case 0x27:
-        // DAA
+        // 0x27	DAA	1	Z, S, P, CY, AC	decimal adjust A
         {
-            uint8_t correction = 0;
-            uint8_t old_acc = state->a; // Save the old accumulator value
+            uint16_t res = state->a;
+            uint8_t cy = state->cc.cy;
+            uint8_t ac = 0;
 
-            // Check lower nibble (bits 0-3)
+            // low nibble first, AC is its carry into the high nibble
             if ((state->a & 0x0F) > 0x9 || state->cc.ac)
             {
-                // correction += 0x06;
-                state->a += 0x06;
-                state->cc.ac = 1; // Set auxiliary carry flag if adjustment is made
+                ac = ((state->a & 0x0F) + 0x06) > 0x0F;
+                res += 0x06;
             }
 
-            // Check upper nibble (bits 4-7)
-            if (((state->a >> 4) & 0x0F) > 0x9 || state->cc.cy)
+            // then the high nibble, after the low one was adjusted
+            if ((res >> 4) > 0x9 || state->cc.cy)
             {
-                correction += 0x60;
-                state->cc.cy = 1; // Set carry flag if adjustment is made
+                res += 0x60;
+                cy = 1;
             }
 
-            // Apply the correction to the accumulator
-            SetFlags(state, state->a + correction);
-            state->a = state->a + correction;
-
-            // Set flags based on the new value in the accumulator
+            SetFlags(state, res);
+            state->cc.cy = cy;
+            state->cc.ac = ac;
+            state->a = res & 0xff;
 
-            // Maintain the carry flag if the result exceeds 8 bits
-            if (state->a < old_acc)
-            {
-                state->cc.cy = 1; // Carry flag is set
-            }
+            state->cycles += 4;
+            opbytes = 1;
+            break;
         }
 
     case 0x28:
@@ -669,7 +763,7 @@ int Emulate8080(State8080 *state)
     {
         // 0x32	STA adr	3		(adr) <- A
         uint16_t adr = ((state->memory[state->pc + 2]) << 8) | (state->memory[state->pc + 1]);
-        state->memory[adr] = state->a;
+        WriteMemory(state, adr, state->a);
         opbytes = 3;
         state->cycles += 4;
         break;
@@ -686,7 +780,7 @@ int Emulate8080(State8080 *state)
     {
         // 	0x34	INR M	1	Z, S, P, AC	(HL) <- (HL)+1
         uint16_t hl = (state->h << 8) + (state->l);
-        state->memory[hl] += 1;
+        WriteMemory(state, hl, state->memory[hl] + 1);
 
         SetFlags(state, state->memory[hl]);
 
@@ -696,7 +790,7 @@ int Emulate8080(State8080 *state)
     }
     case 0x35:
         // 0x35	DCR M	1	Z, S, P, AC	(HL) <- (HL)-1
-        state->memory[(state->h << 8) | (state->l)] -= 1;
+        WriteMemory(state, (state->h << 8) | (state->l), state->memory[(state->h << 8) | (state->l)] - 1);
 
         SetFlags(state, state->memory[(state->h << 8) | (state->l)]);
 
@@ -707,7 +801,7 @@ int Emulate8080(State8080 *state)
     {
         // 0x36	MVI M,D8	2		(HL) <- byte 2
         uint16_t hl_temp = (state->h << 8) + (state->l);
-        state->memory[hl_temp] = state->memory[state->pc + 1];
+        WriteMemory(state, hl_temp, state->memory[state->pc + 1]);
 
         state->cycles += 10;
         opbytes = 2;
@@ -1127,42 +1221,42 @@ int Emulate8080(State8080 *state)
 
     case 0x70:
         // 0x70  MOV M,B  1       (HL) <- B
-        state->memory[(state->h << 8) | state->l] = state->b;
+        WriteMemory(state, (state->h << 8) | state->l, state->b);
         state->cycles += 7;
         opbytes = 1;
         break;
 
     case 0x71:
         // 0x71  MOV M,C  1       (HL) <- C
-        state->memory[(state->h << 8) | state->l] = state->c;
+        WriteMemory(state, (state->h << 8) | state->l, state->c);
         state->cycles += 7;
         opbytes = 1;
         break;
 
     case 0x72:
         // 0x72  MOV M,D  1       (HL) <- D
-        state->memory[(state->h << 8) | state->l] = state->d;
+        WriteMemory(state, (state->h << 8) | state->l, state->d);
         state->cycles += 7;
         opbytes = 1;
         break;
 
     case 0x73:
         // 0x73  MOV M,E  1       (HL) <- E
-        state->memory[(state->h << 8) | state->l] = state->e;
+        WriteMemory(state, (state->h << 8) | state->l, state->e);
         state->cycles += 7;
         opbytes = 1;
         break;
 
     case 0x74:
         // 0x74  MOV M,H  1       (HL) <- H
-        state->memory[(state->h << 8) | state->l] = state->h;
+        WriteMemory(state, (state->h << 8) | state->l, state->h);
         state->cycles += 7;
         opbytes = 1;
         break;
 
     case 0x75:
         // 0x75  MOV M,L  1       (HL) <- L
-        state->memory[(state->h << 8) | state->l] = state->l;
+        WriteMemory(state, (state->h << 8) | state->l, state->l);
         state->cycles += 7;
         opbytes = 1;
         break;
@@ -1176,7 +1270,7 @@ int Emulate8080(State8080 *state)
 
     case 0x77:
         // 0x77  MOV M,A  1       (HL) <- A
-        state->memory[(state->h << 8) | state->l] = state->a;
+        WriteMemory(state, (state->h << 8) | state->l, state->a);
         state->cycles += 7;
         opbytes = 1;
         break;
@@ -1239,153 +1333,101 @@ int Emulate8080(State8080 *state)
 
     case 0x80:
         // 0x80	ADD B	1	Z, S, P, CY, AC	A <- A + B
-        {
-            uint16_t res = state->a + state->b;
-            state->a = res;
-            SetFlags(state, res);
-            state->cycles += 4;
-            opbytes = 1;
-            break;
-        }
+        AddToAccumulator(state, state->b, 0);
+        state->cycles += 4;
+        opbytes = 1;
+        break;
     case 0x81:
         // 0x81	ADD C	1	Z, S, P, CY, AC	A <- A + C
-        {
-            uint16_t res = state->a + state->c;
-            state->a = res;
-            SetFlags(state, res);
-            state->cycles += 4;
-            opbytes = 1;
-            break;
-        }
+        AddToAccumulator(state, state->c, 0);
+        state->cycles += 4;
+        opbytes = 1;
+        break;
     case 0x82:
         // 0x82	ADD D	1	Z, S, P, CY, AC	A <- A + D
-        SetFlags(state, state->a + state->d);
-        state->a = state->a + state->d;
+        AddToAccumulator(state, state->d, 0);
         state->cycles += 4;
         opbytes = 1;
         break;
     case 0x83:
         // 0x83	ADD E	1	Z, S, P, CY, AC	A <- A + E
-        SetFlags(state, state->a + state->e);
-        state->a = state->a + state->e;
+        AddToAccumulator(state, state->e, 0);
         state->cycles += 4;
         opbytes = 1;
         break;
     case 0x84:
         // 0x84	ADD H	1	Z, S, P, CY, AC	A <- A + H
-        SetFlags(state, state->a + state->h);
-        state->a = state->a + state->h;
+        AddToAccumulator(state, state->h, 0);
         state->cycles += 4;
         opbytes = 1;
         break;
     case 0x85:
         // 0x85	ADD L	1	Z, S, P, CY, AC	A <- A + L
-        SetFlags(state, state->a + state->l);
-        state->a = state->a + state->l;
+        AddToAccumulator(state, state->l, 0);
         state->cycles += 4;
         opbytes = 1;
         break;
     case 0x86:
         // 0x86	ADD M	1	Z, S, P, CY, AC	A <- A + (HL)
-        {
-            uint16_t hl = (state->h << 8) + (state->l);
-            SetFlags(state, state->a + state->memory[hl]);
-            state->a = state->a + state->memory[hl];
-            state->cycles += 7;
-            opbytes = 1;
-            break;
-        }
+        AddToAccumulator(state, state->memory[(state->h << 8) | state->l], 0);
+        state->cycles += 7;
+        opbytes = 1;
+        break;
     case 0x87:
         // 0x87	ADD A	1	Z, S, P, CY, AC	A <- A + A
-        SetFlags(state, state->a + state->a);
-        state->a = state->a + state->a;
+        AddToAccumulator(state, state->a, 0);
         state->cycles += 4;
         opbytes = 1;
         break;
 
     case 0x88:
         // 0x88	ADC B	1	Z, S, P, CY, AC	A <- A + B + CY
-        {
-            uint16_t res = state->a + state->b + state->cc.cy;
-            state->a = res;
-            SetFlags(state, res);
-            state->cycles += 4;
-            opbytes = 1;
-            break;
-        }
+        AddToAccumulator(state, state->b, state->cc.cy);
+        state->cycles += 4;
+        opbytes = 1;
+        break;
     case 0x89:
         // 0x89	ADC C	1	Z, S, P, CY, AC	A <- A + C + CY
-        {
-            uint16_t res = state->a + state->c + state->cc.cy;
-            state->a = res;
-            SetFlags(state, res);
-            state->cycles += 4;
-            opbytes = 1;
-            break;
-        }
+        AddToAccumulator(state, state->c, state->cc.cy);
+        state->cycles += 4;
+        opbytes = 1;
+        break;
     case 0x8a:
         // 0x8a	ADC D	1	Z, S, P, CY, AC	A <- A + D + CY
-        {
-            uint8_t a_temp = state->a;
-
-            uint16_t res = state->a + state->d + state->cc.cy;
-            state->a = res;
-            SetFlags(state, res);
-            state->cycles += 4;
-            opbytes = 1;
-            break;
-        }
+        AddToAccumulator(state, state->d, state->cc.cy);
+        state->cycles += 4;
+        opbytes = 1;
+        break;
     case 0x8b:
         // 0x8b	ADC E	1	Z, S, P, CY, AC	A <- A + E + CY
-        {
-            uint16_t res = state->a + state->e + state->cc.cy;
-            state->a = res;
-            SetFlags(state, res);
-            state->cycles += 4;
-            opbytes = 1;
-            break;
-        }
+        AddToAccumulator(state, state->e, state->cc.cy);
+        state->cycles += 4;
+        opbytes = 1;
+        break;
     case 0x8c:
         // 0x8c	ADC H	1	Z, S, P, CY, AC	A <- A + H + CY
-        {
-            uint16_t res = state->a + state->h + state->cc.cy;
-            state->a = res;
-            SetFlags(state, res);
-            state->cycles += 4;
-            opbytes = 1;
-            break;
-        }
+        AddToAccumulator(state, state->h, state->cc.cy);
+        state->cycles += 4;
+        opbytes = 1;
+        break;
     case 0x8d:
         // 0x8d	ADC L	1	Z, S, P, CY, AC	A <- A + L + CY
-        {
-            uint16_t res = state->a + state->l + state->cc.cy;
-            state->a = res;
-            SetFlags(state, res);
-            state->cycles += 4;
-            opbytes = 1;
-            break;
-        }
+        AddToAccumulator(state, state->l, state->cc.cy);
+        state->cycles += 4;
+        opbytes = 1;
+        break;
     case 0x8e:
         // 0x8e	ADC M	1	Z, S, P, CY, AC	A <- A + (HL) + CY
-        {
-            uint16_t res = state->a + state->memory[(state->h << 8) + (state->l)] + state->cc.cy;
-            state->a = res;
-            SetFlags(state, res);
-            state->cycles += 4;
-            opbytes = 1;
-            break;
-        }
+        AddToAccumulator(state, state->memory[(state->h << 8) | state->l], state->cc.cy);
+        state->cycles += 4;
+        opbytes = 1;
+        break;
     case 0x8f:
         // 0x8f	ADC A	1	Z, S, P, CY, AC	A <- A + A + CY
-        {
-            uint16_t res = state->a + state->a + state->cc.cy;
-            state->a = res;
-            SetFlags(state, res);
-            state->cycles += 4;
-            opbytes = 1;
-            break;
-        }
-
+        AddToAccumulator(state, state->a, state->cc.cy);
+        state->cycles += 4;
+        opbytes = 1;
+        break;
         // SUBs
     case 0x90:
         // 0x90	SUB B	1	Z, S, P, CY, AC	A <- A - B
@@ -1845,7 +1887,7 @@ int Emulate8080(State8080 *state)
         // 0xc0	RNZ	1		if NZ, RET
         if (state->cc.z == 0)
         {
-            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])) + 3; // continue at the address right after the conditional call
+            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])); // the return address pushed by CALL
             // printf("Retuning on P... SP=%02x, SP+1=%02x, restoring %02x%02x to PC\n", (state->sp), (state->sp) + 1, state->memory[state->sp + 1], state->memory[state->sp]);
             state->sp += 2;
             opbytes = 0;
@@ -1893,8 +1935,8 @@ int Emulate8080(State8080 *state)
         // 0xc4	CNZ adr	3		if NZ, CALL adr
         if (state->cc.z == 0)
         {
-            state->memory[(state->sp) - 2] = state->pc & 0xFF; // PC.lo
-            state->memory[(state->sp) - 1] = state->pc >> 8;   // PC.hi
+            WriteMemory(state, (state->sp) - 2, (state->pc + 3) & 0xFF); // return address, after the CALL
+            WriteMemory(state, (state->sp) - 1, (state->pc + 3) >> 8);   // PC.hi
             state->sp = (state->sp) - 2;
 
             address = (state->memory[state->pc + 2] << 8) + state->memory[state->pc + 1];
@@ -1905,7 +1947,7 @@ int Emulate8080(State8080 *state)
             // printf("New PC: %02x\n", state->pc);
             // printf("Memory: %04x\n", (state->memory[(state->sp) + 1] << 8) | state->memory[(state->sp)]);
             opbytes = 0;
-            stack[stack_size] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
+            stack[stack_size % 100] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
             stack_size++;
         }
         else
@@ -1919,8 +1961,8 @@ int Emulate8080(State8080 *state)
     case 0xc5:
         // 0xc5	PUSH B	1		(sp-2)<-C; (sp-1)<-B; sp <- sp - 2
         // printf("Executuing 0xc5 PUSH BC");
-        state->memory[state->sp - 2] = state->c;
-        state->memory[state->sp - 1] = state->b;
+        WriteMemory(state, state->sp - 2, state->c);
+        WriteMemory(state, state->sp - 1, state->b);
         state->sp -= 2;
 
         opbytes = 1;
@@ -1928,26 +1970,15 @@ int Emulate8080(State8080 *state)
         break;
     case 0xc6:
         // 0xc6	ADI D8	2	Z, S, P, CY, AC	A <- A + byte
-        {
-            uint16_t res = state->a;
-            res = res + state->memory[state->pc + 1];
-
-            // printf("adi res: %04x\n", res);
-            // printf("CY: %d\n", (res > 0xFF) ? 1 : 0);
-
-            SetFlags(state, res);
-
-            state->a = res & 0xff;
-
-            opbytes = 2;
-            state->cycles += 2;
-            break;
-        }
+        AddToAccumulator(state, state->memory[state->pc + 1], 0);
+        state->cycles += 2;
+        opbytes = 2;
+        break;
     case 0xc8:
         // 0xc8	RZ	1		if Z, RET
         if (state->cc.z == 1)
         {
-            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])) + 3; // continue at the address right after the conditional call
+            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])); // the return address pushed by CALL
 
             // printf("Retuning on zero... SP=%02x, SP+1=%02x, restoring %02x%02x to PC\n", (state->sp), (state->sp) + 1, state->memory[state->sp + 1], state->memory[state->sp]);
             state->sp += 2;
@@ -1963,11 +1994,11 @@ int Emulate8080(State8080 *state)
         break;
     case 0xc9:
         // 0xc9	RET	1		PC.lo <- (sp); PC.hi<-(sp+1); SP <- SP+2
-        state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])) + 2; // continue at the address right after the conditional call
+        state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])); // the return address pushed by CALL
         // printf("Retuning... SP=%02x, SP+1=%02x, restoring %02x%02x to PC\n", (state->sp), (state->sp) + 1, state->memory[state->sp + 1], state->memory[state->sp]);
         state->sp += 2;
 
-        opbytes = 1;
+        opbytes = 0;
         state->cycles += 10;
         break;
 
@@ -1997,8 +2028,8 @@ int Emulate8080(State8080 *state)
         if (state->cc.z == 1)
         {
             // printf("Calling... SP-2=%02x, SP-1=%02x, storing %02x\n", (state->sp) - 2, (state->sp) - 1, state->pc);
-            state->memory[(state->sp) - 2] = state->pc & 0xFF; // PC.lo
-            state->memory[(state->sp) - 1] = state->pc >> 8;   // PC.hi
+            WriteMemory(state, (state->sp) - 2, (state->pc + 3) & 0xFF); // return address, after the CALL
+            WriteMemory(state, (state->sp) - 1, (state->pc + 3) >> 8);   // PC.hi
             state->sp = (state->sp) - 2;
 
             address = (state->memory[state->pc + 2] << 8) + state->memory[state->pc + 1];
@@ -2009,7 +2040,7 @@ int Emulate8080(State8080 *state)
             // printf("SP: %02x\n", state->sp);
             // printf("PC: %02x\n", state->pc);
 
-            stack[stack_size] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
+            stack[stack_size % 100] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
             stack_size++;
 
             opbytes = 0;
@@ -2050,8 +2081,8 @@ int Emulate8080(State8080 *state)
 #endif // using the content of SP as reference address, load PC (2 bytes) into the 2 memory addresses that are before the reference (SP)
 
             // printf("Calling... SP-2=%02x, SP-1=%02x, storing %02x\n", (state->sp) - 2, (state->sp) - 1, state->pc);
-            state->memory[(state->sp) - 2] = state->pc & 0xFF; // PC.lo
-        state->memory[(state->sp) - 1] = state->pc >> 8;       // PC.hi
+            WriteMemory(state, (state->sp) - 2, (state->pc + 3) & 0xFF); // return address, after the CALL
+        WriteMemory(state, (state->sp) - 1, (state->pc + 3) >> 8);       // PC.hi
         state->sp = (state->sp) - 2;
 
         address = (state->memory[state->pc + 2] << 8) + state->memory[state->pc + 1];
@@ -2061,28 +2092,22 @@ int Emulate8080(State8080 *state)
         // printf("\n\nState after call\n\n");
         // printf("SP: %02x\n", state->sp);
         // printf("PC: %02x\n", state->pc);
-        stack[stack_size] = ((state->memory[(state->sp) + 1]) >> 8) | (state->memory[(state->sp)]);
+        stack[stack_size % 100] = ((state->memory[(state->sp) + 1]) >> 8) | (state->memory[(state->sp)]);
         stack_size++;
         opbytes = 0;
         state->cycles += 17;
         break;
     case 0xce:
         // 0xce	ACI D8	2	Z, S, P, CY, AC	A <- A + data + CY
-        {
-            uint16_t res = state->a + state->memory[state->pc + 1] + state->cc.cy;
-            SetFlags(state, res);
-            state->a = res & 0xff;
-            // printf("res after ACI: %04x\n", res);
-            // printf("res && 0xff after ACI: %04x\n", res & 0xff);
-            state->cycles += 2;
-            opbytes = 2;
-            break;
-        }
+        AddToAccumulator(state, state->memory[state->pc + 1], state->cc.cy);
+        state->cycles += 2;
+        opbytes = 2;
+        break;
     case 0xd0:
         // 0xd0	RNC	1		if NCY, RET
         if (state->cc.cy == 0)
         {
-            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])) + 3; // continue at the address right after the conditional call
+            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])); // the return address pushed by CALL
             // printf("Retuning on P... SP=%02x, SP+1=%02x, restoring %02x%02x to PC\n", (state->sp), (state->sp) + 1, state->memory[state->sp + 1], state->memory[state->sp]);
             state->sp += 2;
             opbytes = 0;
@@ -2120,16 +2145,20 @@ int Emulate8080(State8080 *state)
         state->cycles += 10;
         break;
     case 0xd3:
-        // state->bus[state->pc + 1] = state->a;
+        // OUT port, the handler sees the cycle count after the instruction
         opbytes = 2;
         state->cycles += 3;
+        if (state->ports && state->ports->write[opcode[1]])
+        {
+            state->ports->write[opcode[1]](state, opcode[1], state->a);
+        }
         break;
     case 0xd4:
         // 0xd4	CNC adr	3		if NCY, CALL adr
         if (state->cc.cy == 0)
         {
-            state->memory[(state->sp) - 2] = state->pc & 0xFF; // PC.lo
-            state->memory[(state->sp) - 1] = state->pc >> 8;   // PC.hi
+            WriteMemory(state, (state->sp) - 2, (state->pc + 3) & 0xFF); // return address, after the CALL
+            WriteMemory(state, (state->sp) - 1, (state->pc + 3) >> 8);   // PC.hi
             state->sp = (state->sp) - 2;
 
             address = (state->memory[state->pc + 2] << 8) + state->memory[state->pc + 1];
@@ -2139,7 +2168,7 @@ int Emulate8080(State8080 *state)
             // printf("SP: %02x\n", state->sp);
             // printf("PC: %02x\n", state->pc);
             opbytes = 0;
-            stack[stack_size] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
+            stack[stack_size % 100] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
             stack_size++;
         }
         else
@@ -2151,8 +2180,8 @@ int Emulate8080(State8080 *state)
         break;
     case 0xd5:
         // 0xd5	PUSH D	1		(sp-2)<-E; (sp-1)<-D; sp <- sp - 2
-        state->memory[state->sp - 2] = state->e;
-        state->memory[state->sp - 1] = state->d;
+        WriteMemory(state, state->sp - 2, state->e);
+        WriteMemory(state, state->sp - 1, state->d);
         state->sp -= 2;
 
         opbytes = 1;
@@ -2172,7 +2201,7 @@ int Emulate8080(State8080 *state)
         // 0xd8	RC	1		if CY, RET
         if (state->cc.cy == 1)
         {
-            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])) + 3; // continue at the address right after the conditional call
+            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])); // the return address pushed by CALL
             // printf("Retuning on P... SP=%02x, SP+1=%02x, restoring %02x%02x to PC\n", (state->sp), (state->sp) + 1, state->memory[state->sp + 1], state->memory[state->sp]);
             state->sp += 2;
             opbytes = 0;
@@ -2204,12 +2233,18 @@ int Emulate8080(State8080 *state)
         state->cycles += 10;
         break;
     }
+    case 0xdb:
+        // IN port
+        opbytes = 2;
+        state->cycles += 3;
+        state->a = (state->ports && state->ports->read[opcode[1]]) ? state->ports->read[opcode[1]](state, opcode[1]) : 0;
+        break;
     case 0xdc:
         // 0xdc	CC adr	3		if CY, CALL adr
         if (state->cc.cy == 1)
         {
-            state->memory[(state->sp) - 2] = state->pc & 0xFF; // PC.lo
-            state->memory[(state->sp) - 1] = state->pc >> 8;   // PC.hi
+            WriteMemory(state, (state->sp) - 2, (state->pc + 3) & 0xFF); // return address, after the CALL
+            WriteMemory(state, (state->sp) - 1, (state->pc + 3) >> 8);   // PC.hi
             state->sp = (state->sp) - 2;
 
             address = (state->memory[state->pc + 2] << 8) + state->memory[state->pc + 1];
@@ -2219,7 +2254,7 @@ int Emulate8080(State8080 *state)
             // printf("SP: %02x\n", state->sp);
             // printf("PC: %02x\n", state->pc);
             opbytes = 0;
-            stack[stack_size] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
+            stack[stack_size % 100] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
             stack_size++;
         }
         else
@@ -2247,7 +2282,7 @@ int Emulate8080(State8080 *state)
         // 0xe0	RPO	1		if PO, RET
         if (state->cc.p == 0)
         {
-            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])) + 3; // continue at the address right after the conditional call
+            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])); // the return address pushed by CALL
             // printf("Retuning on P... SP=%02x, SP+1=%02x, restoring %02x%02x to PC\n", (state->sp), (state->sp) + 1, state->memory[state->sp + 1], state->memory[state->sp]);
             state->sp += 2;
             opbytes = 0;
@@ -2291,8 +2326,8 @@ int Emulate8080(State8080 *state)
             state->h = state->memory[state->sp + 1];
             state->l = state->memory[state->sp];
 
-            state->memory[state->sp] = l_temp;
-            state->memory[state->sp + 1] = h_temp;
+            WriteMemory(state, state->sp, l_temp);
+            WriteMemory(state, state->sp + 1, h_temp);
 
             state->cycles += 18;
             opbytes = 1;
@@ -2303,8 +2338,8 @@ int Emulate8080(State8080 *state)
         // 0xe4	CPO adr	3		if PO, CALL adr
         if (state->cc.p == 0)
         {
-            state->memory[(state->sp) - 2] = state->pc & 0xFF; // PC.lo
-            state->memory[(state->sp) - 1] = state->pc >> 8;   // PC.hi
+            WriteMemory(state, (state->sp) - 2, (state->pc + 3) & 0xFF); // return address, after the CALL
+            WriteMemory(state, (state->sp) - 1, (state->pc + 3) >> 8);   // PC.hi
             state->sp = (state->sp) - 2;
 
             address = (state->memory[state->pc + 2] << 8) + state->memory[state->pc + 1];
@@ -2314,7 +2349,7 @@ int Emulate8080(State8080 *state)
             // printf("SP: %02x\n", state->sp);
             // printf("PC: %02x\n", state->pc);
             opbytes = 0;
-            stack[stack_size] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
+            stack[stack_size % 100] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
             stack_size++;
         }
         else
@@ -2326,8 +2361,8 @@ int Emulate8080(State8080 *state)
         break;
     case 0xe5:
         // 0xe5	PUSH H	1		(sp-2)<-L; (sp-1)<-H; sp <- sp - 2
-        state->memory[state->sp - 2] = state->l;
-        state->memory[state->sp - 1] = state->h;
+        WriteMemory(state, state->sp - 2, state->l);
+        WriteMemory(state, state->sp - 1, state->h);
         state->sp -= 2;
 
         opbytes = 1;
@@ -2346,7 +2381,7 @@ int Emulate8080(State8080 *state)
         // 0xe8	RPE	1		if PE, RET
         if (state->cc.p == 1)
         {
-            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])) + 3; // continue at the address right after the conditional call
+            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])); // the return address pushed by CALL
             // printf("Retuning on P... SP=%02x, SP+1=%02x, restoring %02x%02x to PC\n", (state->sp), (state->sp) + 1, state->memory[state->sp + 1], state->memory[state->sp]);
             state->sp += 2;
             opbytes = 0;
@@ -2401,8 +2436,8 @@ int Emulate8080(State8080 *state)
         if (state->cc.p == 1)
         {
             // printf("Calling on PE... SP-2=%02x, SP-1=%02x, storing %02x\n", (state->sp) - 2, (state->sp) - 1, state->pc);
-            state->memory[(state->sp) - 2] = state->pc & 0xFF; // PC.lo
-            state->memory[(state->sp) - 1] = state->pc >> 8;   // PC.hi
+            WriteMemory(state, (state->sp) - 2, (state->pc + 3) & 0xFF); // return address, after the CALL
+            WriteMemory(state, (state->sp) - 1, (state->pc + 3) >> 8);   // PC.hi
             state->sp = (state->sp) - 2;
 
             address = (state->memory[state->pc + 2] << 8) + state->memory[state->pc + 1];
@@ -2412,7 +2447,7 @@ int Emulate8080(State8080 *state)
             // printf("SP: %02x\n", state->sp);
             // printf("PC: %02x\n", state->pc);
             opbytes = 0;
-            stack[stack_size] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
+            stack[stack_size % 100] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
             stack_size++;
         }
         else
@@ -2441,7 +2476,7 @@ int Emulate8080(State8080 *state)
         // 0xf0	RP	1		if P (cc.s = 0), RET
         if (state->cc.s == 0)
         {
-            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])) + 3; // continue at the address right after the conditional call
+            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])); // the return address pushed by CALL
             // printf("Retuning on P... SP=%02x, SP+1=%02x, restoring %02x%02x to PC\n", (state->sp), (state->sp) + 1, state->memory[state->sp + 1], state->memory[state->sp]);
             state->sp += 2;
             opbytes = 0;
@@ -2500,8 +2535,8 @@ int Emulate8080(State8080 *state)
         // 0xf4	CP adr	3		if P, PC <- adr
         if (state->cc.s == 0)
         {
-            state->memory[(state->sp) - 2] = state->pc & 0xFF; // PC.lo
-            state->memory[(state->sp) - 1] = state->pc >> 8;   // PC.hi
+            WriteMemory(state, (state->sp) - 2, (state->pc + 3) & 0xFF); // return address, after the CALL
+            WriteMemory(state, (state->sp) - 1, (state->pc + 3) >> 8);   // PC.hi
             state->sp = (state->sp) - 2;
 
             address = (state->memory[state->pc + 2] << 8) + state->memory[state->pc + 1];
@@ -2511,7 +2546,7 @@ int Emulate8080(State8080 *state)
             // printf("SP: %02x\n", state->sp);
             // printf("PC: %02x\n", state->pc);
             opbytes = 0;
-            stack[stack_size] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
+            stack[stack_size % 100] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
             stack_size++;
         }
         else
@@ -2526,8 +2561,8 @@ int Emulate8080(State8080 *state)
         {
             // printf("Executing 0xf5 PUSH PSW");
             uint8_t flags = (state->cc.s << 7) + (state->cc.z << 6) + (0 << 5) + (state->cc.ac << 4) + (0 << 3) + (state->cc.p << 2) + (1 << 1) + (state->cc.cy);
-            state->memory[state->sp - 2] = flags;
-            state->memory[state->sp - 1] = state->a;
+            WriteMemory(state, state->sp - 2, flags);
+            WriteMemory(state, state->sp - 1, state->a);
             state->sp -= 2;
 
             opbytes = 1;
@@ -2547,7 +2582,7 @@ int Emulate8080(State8080 *state)
         // 0xf8	RM	1		if M, RET
         if (state->cc.s == 1)
         {
-            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])) + 3; // continue at the address right after the conditional call
+            state->pc = ((state->memory[state->sp + 1] << 8) + (state->memory[state->sp])); // the return address pushed by CALL
             // printf("Retuning on P... SP=%02x, SP+1=%02x, restoring %02x%02x to PC\n", (state->sp), (state->sp) + 1, state->memory[state->sp + 1], state->memory[state->sp]);
             state->sp += 2;
             opbytes = 0;
@@ -2598,8 +2633,8 @@ int Emulate8080(State8080 *state)
         // 0xfc	CM adr	3		if M, CALL adr
         if (state->cc.s == 1)
         {
-            state->memory[(state->sp) - 2] = state->pc & 0xFF; // PC.lo
-            state->memory[(state->sp) - 1] = state->pc >> 8;   // PC.hi
+            WriteMemory(state, (state->sp) - 2, (state->pc + 3) & 0xFF); // return address, after the CALL
+            WriteMemory(state, (state->sp) - 1, (state->pc + 3) >> 8);   // PC.hi
             state->sp = (state->sp) - 2;
 
             address = (state->memory[state->pc + 2] << 8) + state->memory[state->pc + 1];
@@ -2609,7 +2644,7 @@ int Emulate8080(State8080 *state)
             // printf("SP: %02x\n", state->sp);
             // printf("PC: %02x\n", state->pc);
             opbytes = 0;
-            stack[stack_size] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
+            stack[stack_size % 100] = ((state->memory[(state->sp) + 1]) << 8) | (state->memory[(state->sp)]);
             stack_size++;
         }
         else
@@ -2642,3 +2677,14 @@ int Emulate8080(State8080 *state)
 
     return opbytes;
 }
+
+// The interpreter's step. Execute8080 itself doesn't trace, so the cores
+// built on it and the idiom look-aheads (idiom.c) run silently
+int Emulate8080(State8080 *state)
+{
+    if (LOGS_CPU)
+    {
+        printf("Executing opcode: %02x, PC is %02x\n", state->memory[state->pc], state->pc);
+    }
+    return Execute8080(state, state->memory[state->pc]);
+}
@@ -0,0 +1,232 @@
+#include "8080.c"
+#include <string.h>
+
+// Static recompiler: turns invaders.rom into recompiled.c, a C function with one
+// label per basic block, built against machine.c with -DRECOMPILED=1.
+//
+//   8080recompiler [rom] [output]
+//
+// The code is found by following jumps and calls from the reset and interrupt
+// vectors. Each instruction becomes a call to Execute8080 with a constant opcode
+// (same trick as fuse.c), so the semantics stay the ones of the interpreter.
+// Anything the analysis can't see statically (RET, PCHL, RST, code in RAM,
+// a jump into the middle of nowhere) goes back through the dispatch switch,
+// and if PC is not a known block the interpreter takes over.
+// IN and OUT go through the machine's port table like in the interpreter.
+// The flow analysis is its own: 8080disassembler.c only dumps the bytes (its
+// decoder is all commented out), there's no control flow graph in there to
+// reuse, and opcode_lengths from 8080.c is all the decoding this needs.
+
+#define ROM_SIZE 0x2000
+
+uint8_t rom[ROM_SIZE];
+int rom_size;
+
+// reached by the flow analysis
+uint8_t is_code[ROM_SIZE];
+// start of a basic block
+uint8_t is_block[ROM_SIZE];
+
+int IsJump(uint8_t op)
+{
+    return op == 0xc3 || op == 0xc2 || op == 0xca || op == 0xd2 || op == 0xda ||
+           op == 0xe2 || op == 0xea || op == 0xf2 || op == 0xfa;
+}
+
+int IsCall(uint8_t op)
+{
+    return op == 0xcd || op == 0xc4 || op == 0xcc || op == 0xd4 || op == 0xdc ||
+           op == 0xe4 || op == 0xec || op == 0xf4 || op == 0xfc;
+}
+
+int IsConditionalReturn(uint8_t op)
+{
+    return op == 0xc0 || op == 0xc8 || op == 0xd0 || op == 0xd8 ||
+           op == 0xe0 || op == 0xe8 || op == 0xf0 || op == 0xf8;
+}
+
+// RET, PCHL, RST n: where it goes is only known at run time
+int IsDynamic(uint8_t op)
+{
+    return op == 0xc9 || op == 0xe9 || IsConditionalReturn(op) || (op & 0xc7) == 0xc7;
+}
+
+// does execution never continue with the next instruction
+int EndsFlow(uint8_t op)
+{
+    return op == 0xc3 || op == 0xc9 || op == 0xe9 || (op & 0xc7) == 0xc7;
+}
+
+int InRom(int address)
+{
+    return address >= 0 && address + 3 <= rom_size;
+}
+
+// recursive descent from the entry points, marking code and block starts
+void FindBlocks()
+{
+    static uint16_t work[ROM_SIZE];
+    int pending = 0;
+
+    // reset, RST 1 and RST 2 (the two video interrupts)
+    work[pending++] = 0x0000;
+    work[pending++] = 0x0008;
+    work[pending++] = 0x0010;
+    is_block[0x0000] = is_block[0x0008] = is_block[0x0010] = 1;
+
+    while (pending)
+    {
+        int pc = work[--pending];
+
+        while (InRom(pc) && !is_code[pc])
+        {
+            uint8_t op = rom[pc];
+            int next = pc + opcode_lengths[op];
+            int target = (rom[pc + 2] << 8) | rom[pc + 1];
+
+            is_code[pc] = 1;
+
+            if (IsJump(op) || IsCall(op))
+            {
+                if (InRom(target) && !is_block[target])
+                {
+                    is_block[target] = 1;
+                    work[pending++] = target;
+                }
+            }
+
+            if (EndsFlow(op))
+            {
+                break;
+            }
+
+            // a block ends on anything that can branch, and starts again after it
+            if (IsJump(op) || IsCall(op) || IsDynamic(op))
+            {
+                if (InRom(next))
+                {
+                    is_block[next] = 1;
+                }
+            }
+            pc = next;
+        }
+    }
+}
+
+// if (PC == target) goto its block, for each static successor
+void EmitSuccessor(FILE *out, int target)
+{
+    if (InRom(target) && is_block[target])
+    {
+        fprintf(out, "    if (state->pc == 0x%04x)\n        goto block_%04x;\n", target, target);
+    }
+}
+
+void EmitBlock(FILE *out, int start)
+{
+    int pc = start;
+
+    fprintf(out, "\nblock_%04x:\n", start);
+
+    while (1)
+    {
+        uint8_t op = rom[pc];
+        int next = pc + opcode_lengths[op];
+        int target = (rom[pc + 2] << 8) | rom[pc + 1];
+
+        fprintf(out, "    STEP(0x%02x) // $%04x\n", op, pc);
+
+        if (IsJump(op) || IsCall(op))
+        {
+            EmitSuccessor(out, target);
+        }
+
+        if (EndsFlow(op) || IsJump(op) || IsCall(op) || IsDynamic(op) || !InRom(next) || is_block[next])
+        {
+            if (!EndsFlow(op))
+            {
+                EmitSuccessor(out, next);
+            }
+            fprintf(out, "    goto dispatch;\n");
+            return;
+        }
+
+        pc = next;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *rom_path = (argc > 1) ? argv[1] : "invaders.rom";
+    const char *out_path = (argc > 2) ? argv[2] : "recompiled.c";
+    int address;
+
+    FILE *fp = fopen(rom_path, "rb");
+
+    if (fp == NULL)
+    {
+        printf("error: Couldn't open %s\n", rom_path);
+        exit(1);
+    }
+
+    rom_size = fread(rom, 1, ROM_SIZE, fp);
+    fclose(fp);
+
+    FindBlocks();
+
+    FILE *out = fopen(out_path, "w");
+
+    if (out == NULL)
+    {
+        printf("error: Couldn't write %s\n", out_path);
+        exit(1);
+    }
+
+    int blocks = 0, instructions = 0;
+    for (address = 0; address < ROM_SIZE; address++)
+    {
+        blocks += is_block[address];
+        instructions += is_code[address];
+    }
+
+    fprintf(out, "// Generated by 8080recompiler from %s, do not edit.\n", rom_path);
+    fprintf(out, "// %d basic blocks, %d instructions\n\n", blocks, instructions);
+
+    fprintf(out, "// one instruction, stopping where the interpreter would take the interrupt\n");
+    fprintf(out, "#define STEP(op)                                    \\\n");
+    fprintf(out, "    state->pc += Execute8080(state, op);            \\\n");
+    fprintf(out, "    ran++;                                          \\\n");
+    fprintf(out, "    if (deadline && (int)(state->cycles - deadline) >= 0) \\\n");
+    fprintf(out, "    {                                               \\\n");
+    fprintf(out, "        return ran;                                 \\\n");
+    fprintf(out, "    }\n\n");
+
+    fprintf(out, "// Runs recompiled blocks from PC until the deadline or code\n");
+    fprintf(out, "// that isn't in here. Returns the number of instructions executed\n");
+    fprintf(out, "int RunRecompiled(State8080 *state, uint64_t deadline)\n{\n");
+    fprintf(out, "    int ran = 0;\n\n");
+    fprintf(out, "dispatch:\n    switch (state->pc)\n    {\n");
+    for (address = 0; address < ROM_SIZE; address++)
+    {
+        if (is_block[address])
+        {
+            fprintf(out, "    case 0x%04x:\n        goto block_%04x;\n", address, address);
+        }
+    }
+    fprintf(out, "    default:\n        return ran;\n    }\n");
+
+    for (address = 0; address < ROM_SIZE; address++)
+    {
+        if (is_block[address])
+        {
+            EmitBlock(out, address);
+        }
+    }
+
+    fprintf(out, "}\n\n#undef STEP\n");
+    fclose(out);
+
+    printf("%s: %d basic blocks, %d instructions\n", out_path, blocks, instructions);
+
+    return 0;
+}
@@ -1,4 +1,11 @@
-#include "8080.c"
+#include "machine.c"
+#include "video.c"
+#include "pacer.c"
+#include "turbo.c"
+#include "savestate.c"
+#include "runahead.c"
+#include "scale.c"
+#include "phosphor.c"
 #include <stdio.h>
 #include <stdlib.h>
 // #include "SDL2/include/SDL2/SDL.h"
@@ -9,107 +16,545 @@
 #include <time.h>
 #include <stdbool.h>
 
-typedef struct ShiftRegister
+int frame_count = 0;
+
+double TicksToMs(uint64_t ticks)
 {
-    uint8_t shift_reg_lo; // shift_reg[0]
-    uint8_t shift_reg_hi; // shift_reg[1]
-    uint8_t shift_offset;
+    return ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
 
-} ShiftRegister;
+// Input to photon: from Left or Right going down to the end of the present of
+// the first frame where the ship's strip at the bottom of the screen (the fifth
+// byte of each video RAM column, 32 to 39 pixels up) changed. Gives up after
+// 250 ms, the ship may be against the side or not there at all
+#define PROBE_ROW 4
+#define PROBE_TIMEOUT_MS 250
 
-bool continue_exec = false;
+typedef struct LatencyProbe
+{
+    uint64_t pressed; // 0 when not waiting
+    uint8_t strip[VIDEO_WIDTH];
+} LatencyProbe;
 
-uint8_t r_port[4];
-uint8_t w_port[7];
+Histogram key_latency = {"Left/Right key to photon"};
 
-int last_interrupt = 0;
-int frame_count = 0;
+void ProbeKey(LatencyProbe *probe, const uint8_t *vram)
+{
+    int x;
+
+    if (probe->pressed)
+    {
+        return;
+    }
+    probe->pressed = SDL_GetPerformanceCounter();
+    for (x = 0; x < VIDEO_WIDTH; x++)
+    {
+        probe->strip[x] = vram[x * 32 + PROBE_ROW];
+    }
+}
 
-uint8_t MachineIN(uint8_t port, uint8_t data)
+// After presenting vram
+void ProbePresented(LatencyProbe *probe, const uint8_t *vram)
 {
-    uint8_t acc;
-    ShiftRegister *shift;
+    int x;
 
-    switch (port)
+    if (!probe->pressed)
     {
-    case 1:
+        return;
+    }
+
+    double ms = TicksToMs(SDL_GetPerformanceCounter() - probe->pressed);
+    for (x = 0; x < VIDEO_WIDTH; x++)
     {
-        acc = data;
-        break;
+        if (probe->strip[x] != vram[x * 32 + PROBE_ROW])
+        {
+            HistogramAdd(&key_latency, ms);
+            probe->pressed = 0;
+            return;
+        }
     }
-    case 3:
+    if (ms > PROBE_TIMEOUT_MS)
     {
-        // perform the shift register mask with the offset
-        uint16_t shift_reg_temp = (shift->shift_reg_hi << 8) | (shift->shift_reg_lo);
+        probe->pressed = 0;
+    }
+}
 
-        acc = (shift_reg_temp >> (8 - shift->shift_offset)) & 0xff;
-        break;
+// Tab toggles fast-forward (turbo.c), the title shows how fast it goes
+void TurboTitle(SDL_Window *window, Turbo *turbo)
+{
+    char title[64];
+
+    if (!turbo->on)
+    {
+        SDL_SetWindowTitle(window, "Space Invaders");
+        return;
     }
+    snprintf(title, sizeof(title), "Space Invaders - %.1fx, 1 frame in %d shown", turbo->speed, turbo->frames);
+    SDL_SetWindowTitle(window, title);
+}
+
+DirtyStats dirty_stats;
+
+// colors of the lit pixels, the cabinet's overlay by default
+Overlay overlay;
+
+// software scaling, NULL to leave it to the GPU
+const Scaler *scaler = NULL;
+
+// fading of the pixels that went dark, glow is NULL when it's off
+Phosphor phosphor;
+
+// the board behind the machine's ports (inputs, shift register, sound)
+MachineDevice machine_device;
 
-    default:
-        break;
+// the machine's sounds (sound.c), made on the emulation side and played by the
+// audio callback; audio is 0 when there's no sound
+Sound sound;
+SoundRing sound_ring;
+SDL_AudioDeviceID audio = 0;
+
+// the device plays from when the ring is half full, with as much room for a
+// late frame as for a burst of them; emulation side
+int audio_paused = TRUE;
+
+void AudioCallback(void *userdata, Uint8 *stream, int len)
+{
+    SoundRingPop((SoundRing *)userdata, (int16_t *)stream, len / (int)sizeof(int16_t));
+}
+
+// Opens the audio device, with at most about latency_ms between the machine
+// making a sound and it coming out. Returns FALSE if there's no audio
+int AudioOpen(int latency_ms, uint32_t cycles)
+{
+    SDL_AudioSpec want = {0}, have;
+    int latency = SOUND_RATE * latency_ms / 1000;
+
+    // the device takes at most a quarter of that at a time, the ring holds the rest
+    want.freq = SOUND_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = 64;
+    while (want.samples < 4096 && want.samples * 8 <= latency)
+    {
+        want.samples <<= 1;
     }
+    want.callback = AudioCallback;
+    want.userdata = &sound_ring;
 
-    return acc;
+    SoundInit(&sound, SOUND_RATE, cycles);
+    if (latency <= 0 || !SoundRingInit(&sound_ring, latency))
+    {
+        return FALSE;
+    }
+    audio = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (!audio)
+    {
+        printf("No sound: %s\n", SDL_GetError());
+        SoundRingRelease(&sound_ring);
+        return FALSE;
+    }
+    // paused, AudioFrame starts it once the ring is half full
+    return TRUE;
 }
 
-uint8_t MachineOUT(uint8_t port, uint8_t value)
+// The sound of the frame just run, on its way to the device
+void AudioFrame(State8080 *state)
 {
+    const int16_t *samples;
+    int count;
 
-    ShiftRegister *shift;
+    if (audio)
+    {
+        count = SoundTake(&sound, state->cycles, &samples);
+        SoundRingPush(&sound_ring, samples, count);
+        if (audio_paused && SoundRingQueued(&sound_ring) >= sound_ring.limit / 2)
+        {
+            SDL_PauseAudioDevice(audio, 0);
+            audio_paused = FALSE;
+        }
+    }
+}
 
-    switch (port)
+// No sound while fast-forwarding: the device is paused rather than fed
+// silence, which would count as underruns, and it picks up from where the
+// machine got to once the ring fills up again
+void AudioTurbo(State8080 *state, int turbo)
+{
+    MachineDeviceOf(state)->sound = (audio && !turbo) ? &sound : NULL;
+    SoundSync(&sound, state->cycles);
+    if (audio)
     {
-    case 2:
+        // paused either way, AudioFrame starts it again
+        SDL_PauseAudioDevice(audio, 1);
+        audio_paused = TRUE;
+        SoundRingRestart(&sound_ring);
+    }
+}
+
+void AudioClose()
+{
+    if (audio)
     {
-        // set offset for the shifting
-        shift->shift_offset = value & 0x7;
-        break;
+        SDL_CloseAudioDevice(audio);
+        printf("Sound: %ld underruns (%.1f ms of silence), %ld samples dropped\n", (long)sound_ring.underruns,
+               sound_ring.silence * 1000.0 / SOUND_RATE, sound_ring.overruns + sound.dropped);
+        SoundRingRelease(&sound_ring);
+        audio = 0;
     }
-    case 4:
+}
+
+// Converts the dirty columns of vram (video.c), scales them when there's a
+// scaler, and uploads them, a rectangle per run of them. With the phosphor on
+// everything that's still fading changes each frame, so it's all uploaded
+void DrawDirty(SDL_Texture *texture, const uint8_t *vram, const uint32_t *dirty)
+{
+    static uint32_t pixels[VIDEO_WIDTH * VIDEO_HEIGHT];
+    static uint32_t scaled[9 * VIDEO_WIDTH * VIDEO_HEIGHT];
+    int x = 0, width, factor = scaler ? scaler->factor : 1;
+
+    VideoDrawDirty(vram, pixels, &overlay, dirty);
+    while ((width = VideoDirtyRun(dirty, &x)) > 0)
     {
-        // shift value into shift register
-        uint16_t shift_reg_temp = (shift->shift_reg_hi << 8) | (shift->shift_reg_lo);
+        int first = x, last = x + width;
+        uint32_t *source = pixels;
 
-        // move high bits into low, and value into high
-        shift->shift_reg_lo = shift->shift_reg_hi;
-        shift->shift_reg_hi = value;
+        if (scaler)
+        {
+            ScaleWiden(&first, &last);
+            scaler->run(pixels, scaled, first, last);
+            source = scaled;
+        }
 
-        break;
+        if (!phosphor.glow)
+        {
+            SDL_Rect rect = {first * factor, 0, (last - first) * factor, VIDEO_HEIGHT * factor};
+            SDL_UpdateTexture(texture, &rect, source + first * factor, factor * VIDEO_WIDTH * sizeof(uint32_t));
+        }
+        x += width;
     }
-    default:
-        break;
+
+    if (phosphor.glow)
+    {
+        const uint32_t *glow = PhosphorApply(&phosphor, scaler ? scaled : pixels);
+        SDL_UpdateTexture(texture, NULL, glow, factor * VIDEO_WIDTH * sizeof(uint32_t));
     }
 }
 
-uint8_t MachineKeyDown(uint8_t port, uint8_t value)
+int RefreshRate(SDL_Window *window)
 {
-    r_port[1] |= value;
-    MachineIN(port, r_port[1]);
+    SDL_DisplayMode mode;
+
+    if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) != 0)
+    {
+        return 0;
+    }
+    return mode.refresh_rate;
 }
 
-uint8_t MachineKeyUp(uint8_t port, uint8_t value)
+#if RENDER_THREAD
+// The emulation thread runs frames, paced to real time (pacer.c), and
+// publishes them at VBlank, the main thread takes care of the window: events,
+// drawing and presenting (which can wait on vsync without holding up the
+// emulation)
+
+TripleBuffer video;
+
+// port 1 as set by the keyboard on the main thread, read at every frame
+_Atomic uint8_t input_port1 = 0;
+_Atomic int emulation_running = 1;
+_Atomic int turbo_on = 0;
+
+Histogram emulation_jitter = {"Emulation frame period off by"};
+Histogram frame_latency = {"VBlank to present"};
+
+typedef struct Emulation
 {
-    r_port[1] &= value;
-    MachineIN(port, r_port[1]);
-}
+    State8080 *state;
+    const char *export_name;
+    int run_ahead;
+} Emulation;
 
-void Interrupt(State8080 *state, uint8_t int_num)
+int EmulationThread(void *data)
 {
-    // Basically the implementation of a RST function, which is a special CALL
-    // only difference is the value set into the PC
-    state->memory[(state->sp) - 2] = state->pc & 0xFF; // PC.lo
-    state->memory[(state->sp) - 1] = state->pc >> 8;   // PC.hi
-    state->sp = (state->sp) - 2;
+    Emulation *emulation = (Emulation *)data;
+    State8080 *state = emulation->state;
+    uint64_t period = SDL_GetPerformanceFrequency() / FRAMES_PER_SECOND;
+    uint64_t last_vblank = 0;
+    Pacer pacer;
+    uint32_t number = 0;
+    int turbo = 0;
+    static RunAhead ahead;
+    uint32_t dirty[VIDEO_DIRTY_WORDS], unseen[VIDEO_DIRTY_WORDS] = {0};
+    int word;
+
+    ahead.frames = emulation->run_ahead;
+    state->write_hook = VideoWriteHook;
+    AudioTurbo(state, FALSE);
+
+#if SHARED_EXPORT
+    // the export belongs to the thread that runs the machine
+    if (emulation->export_name && !ExportOpen(emulation->export_name))
+    {
+        printf("error: Couldn't set up the shared memory %s\n", emulation->export_name);
+    }
+#endif
 
-    state->pc = 8 * int_num;
+    PacerInit(&pacer, state->cycles);
+    while (atomic_load(&emulation_running))
+    {
+        if (turbo != atomic_load(&turbo_on))
+        {
+            // back to real time from wherever the machine got to
+            turbo = !turbo;
+            PacerInit(&pacer, state->cycles);
+            last_vblank = 0;
+            // run-ahead goes off or on, the screen jumps
+            VideoDirtyAll();
+            AudioTurbo(state, turbo);
+        }
+
+        // no run-ahead when fast-forwarding, nobody is playing then
+        MachineDeviceOf(state)->r_port[1] = atomic_load(&input_port1);
+        const uint8_t *vram = state->memory + 0x2400;
+        if (turbo)
+        {
+            MachineRunFrame(state);
+        }
+        else
+        {
+            vram = RunAheadFrame(&ahead, state);
+            AudioFrame(state);
+        }
+        number++;
+
+        // fast-forwarding, a frame only goes out once the render thread took
+        // the last one, so N is however many frames it ran meanwhile
+        if (turbo && !TripleBufferTaken(&video))
+        {
+            continue;
+        }
+
+        // the frame has the columns changed since the last one the render
+        // thread took, which is as far as anybody knows the one before
+        VideoFrame *frame = TripleBufferBack(&video);
+        VideoTakeDirty(dirty);
+        if (FOR_CPUDIAG)
+        {
+            // the diagnostic's memory from 0, all of it every time
+            vram = state->memory;
+            memset(dirty, 0xff, sizeof(dirty));
+        }
+        for (word = 0; word < VIDEO_DIRTY_WORDS; word++)
+        {
+            unseen[word] |= dirty[word];
+        }
+        memcpy(frame->dirty, unseen, sizeof(frame->dirty));
+        frame->number = number;
+        frame->playing = state->memory[0x20ef]; // gameMode
+        memcpy(frame->vram, vram, sizeof(frame->vram));
+        frame->published = SDL_GetPerformanceCounter();
+        if (TripleBufferPublish(&video))
+        {
+            // the one before was taken, so this one has only to be newer than it
+            memcpy(unseen, dirty, sizeof(unseen));
+        }
+
+        if (turbo)
+        {
+            continue;
+        }
+
+        if (last_vblank)
+        {
+            int64_t off = (int64_t)(frame->published - last_vblank) - (int64_t)period;
+            HistogramAdd(&emulation_jitter, TicksToMs(off < 0 ? -off : off));
+        }
+        last_vblank = frame->published;
+
+        PacerWait(&pacer, state->cycles);
+    }
+
+    PacerReport(&pacer);
+#if SHARED_EXPORT
+    if (emulation->export_name)
+    {
+        ExportClose();
+        ExportRemove(emulation->export_name);
+    }
+#endif
+    return 0;
 }
 
-int current_time;
-int elapsed_time, max_elapsed;
+int RunWithRenderThread(SDL_Window *window, SDL_Renderer *renderer, State8080 *state, const char *export_name, int run_ahead)
+{
+    int factor = scaler ? scaler->factor : 1;
+    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                             factor * VIDEO_WIDTH, factor * VIDEO_HEIGHT);
+    Emulation emulation = {state, export_name, run_ahead};
+    SDL_Event event;
+    Turbo turbo;
+    uint32_t shown = 0;
+    LatencyProbe probe = {0};
+    const uint8_t *on_screen;
+
+    if (!texture)
+    {
+        printf("Error creating texture: %s\n", SDL_GetError());
+        return 0;
+    }
+
+    TripleBufferInit(&video);
+    on_screen = video.frames[video.front].vram;
+    TurboInit(&turbo, RefreshRate(window));
+    SDL_Thread *thread = SDL_CreateThread(EmulationThread, "emulation", &emulation);
+
+    while (atomic_load(&emulation_running))
+    {
+        while (SDL_PollEvent(&event))
+        {
+            if (event.type == SDL_QUIT)
+            {
+                atomic_store(&emulation_running, 0);
+            }
+
+            if (event.type == SDL_KEYDOWN && event.key.keysym.scancode == SDL_SCANCODE_TAB && !event.key.repeat)
+            {
+                TurboToggle(&turbo);
+                atomic_store(&turbo_on, turbo.on);
+                TurboTitle(window, &turbo);
+            }
+
+            // port 1 bits, same as the single thread loop
+            uint8_t bit = 0;
+            if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP)
+            {
+                switch (event.key.keysym.scancode)
+                {
+                case SDL_SCANCODE_C:
+                    bit = 0x01;
+                    break;
+                case SDL_SCANCODE_1:
+                    bit = 0x04;
+                    break;
+                case SDL_SCANCODE_SPACE:
+                    bit = 0x10;
+                    break;
+                case SDL_SCANCODE_LEFT:
+                    bit = 0x20;
+                    break;
+                case SDL_SCANCODE_RIGHT:
+                    bit = 0x40;
+                    break;
+                }
+            }
+            if (event.type == SDL_KEYDOWN)
+            {
+                atomic_fetch_or(&input_port1, bit);
+                if ((bit & 0x60) && !event.key.repeat)
+                {
+                    ProbeKey(&probe, on_screen);
+                }
+            }
+            else if (event.type == SDL_KEYUP)
+            {
+                atomic_fetch_and(&input_port1, (uint8_t)~bit);
+            }
+        }
+
+        int fresh;
+        VideoFrame *frame = TripleBufferNewest(&video, &fresh);
+        if (!fresh)
+        {
+            SDL_Delay(1);
+            continue;
+        }
+
+        DrawDirty(texture, frame->vram, frame->dirty);
+        if (!FOR_CPUDIAG)
+        {
+            DirtyStatsAdd(&dirty_stats, frame->dirty, frame->playing);
+        }
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, NULL, NULL);
+        SDL_RenderPresent(renderer);
+
+        HistogramAdd(&frame_latency, TicksToMs(SDL_GetPerformanceCounter() - frame->published));
+        on_screen = frame->vram;
+        ProbePresented(&probe, on_screen);
+
+        // here the emulation thread does the adapting: N is just what it skipped
+        turbo.frames = frame->number - shown;
+        shown = frame->number;
+        if (TurboMeasure(&turbo, frame->number) && turbo.on)
+        {
+            TurboTitle(window, &turbo);
+        }
+    }
+
+    SDL_WaitThread(thread, NULL);
+    SDL_DestroyTexture(texture);
+
+    HistogramPrint(&emulation_jitter);
+    HistogramPrint(&frame_latency);
+    HistogramPrint(&key_latency);
+    DirtyStatsPrint(&dirty_stats);
+    return 0;
+}
+#endif
 
 int main(int argc, char **argv)
 {
+    // SpaceInvaders -export /invaders: frames for other processes (export.c)
+    // SpaceInvaders -runahead N: shows frames N frames ahead (runahead.c)
+    // SpaceInvaders -overlay file: another color overlay (overlay.c), none for black and white
+    // SpaceInvaders -scale scale2x: software scaling (scale.c), the window grows with it
+    // SpaceInvaders -phosphor 0.5: dark pixels fade out, keeping that much a frame (phosphor.c)
+    // SpaceInvaders -latency 60: most milliseconds of sound buffered (sound.c), 0 for no sound
+    const char *export_name = NULL;
+    const char *overlay_path = "assets/overlay.txt";
+    int run_ahead = 0;
+    double decay = 0;
+    int latency_ms = 60;
+    int arg;
+    for (arg = 1; arg + 1 < argc; arg += 2)
+    {
+        if (strcmp(argv[arg], "-export") == 0)
+        {
+            export_name = argv[arg + 1];
+        }
+        else if (strcmp(argv[arg], "-runahead") == 0)
+        {
+            run_ahead = atoi(argv[arg + 1]);
+        }
+        else if (strcmp(argv[arg], "-overlay") == 0)
+        {
+            overlay_path = argv[arg + 1];
+        }
+        else if (strcmp(argv[arg], "-scale") == 0 && !(scaler = ScalerFind(argv[arg + 1])))
+        {
+            printf("No scaler called %s, the GPU does the scaling\n", argv[arg + 1]);
+        }
+        else if (strcmp(argv[arg], "-phosphor") == 0)
+        {
+            decay = atof(argv[arg + 1]);
+        }
+        else if (strcmp(argv[arg], "-latency") == 0)
+        {
+            latency_ms = atoi(argv[arg + 1]);
+        }
+    }
+    int factor = scaler ? scaler->factor : 1;
+
+    if (decay > 0 && !PhosphorInit(&phosphor, factor * factor * VIDEO_WIDTH * VIDEO_HEIGHT, decay))
+    {
+        printf("No memory for the phosphor, pixels go dark at once\n");
+    }
+
+    OverlayMonochrome(&overlay);
+    if (strcmp(overlay_path, "none") != 0 && !OverlayLoad(&overlay, overlay_path))
+    {
+        printf("Couldn't load the overlay %s, black and white it is\n", overlay_path);
+    }
 
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
     {
@@ -124,7 +569,14 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    SDL_Window *window = SDL_CreateWindow("Space Invaders", (1920/2) - 256, SDL_WINDOWPOS_CENTERED, 256, 300, 0);
+#if RENDER_THREAD
+    // twice the size, stretched by the GPU, unless there's a scaler
+    int window_factor = scaler ? factor : 2;
+    SDL_Window *window = SDL_CreateWindow("Space Invaders", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                                          VIDEO_WIDTH * window_factor, VIDEO_HEIGHT * window_factor, 0);
+#else
+    SDL_Window *window = SDL_CreateWindow("Space Invaders", (1920/2) - 256, SDL_WINDOWPOS_CENTERED, 256 * factor, VIDEO_HEIGHT * factor + 56, 0);
+#endif
     if (!window)
     {
         printf("Error creating window: %s\n", SDL_GetError());
@@ -140,7 +592,11 @@ int main(int argc, char **argv)
     //     return 0;
     // }
 
+#if RENDER_THREAD
+    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+#else
     SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, 0);
+#endif
     if (!renderer)
     {
         printf("Error creating renderer: %s\n", SDL_GetError());
@@ -163,9 +619,7 @@ int main(int argc, char **argv)
 
     InitializeRegisters(state);
     InitializeMemory(state);
-
-    int opbytes = 1;
-    int instr_count = 0;
+    MachineConnect(state, &machine_device);
 
     if (!state)
     {
@@ -240,7 +694,50 @@ int main(int argc, char **argv)
         // state->memory[0x59e] = 0x05;
     }
 
+#if STATE_HASH
+    HashMemory(state);
+#endif
+
+    if (latency_ms > 0 && !AudioOpen(latency_ms, state->cycles))
+    {
+        printf("Running without sound\n");
+    }
+
     // let the engine run
+#if FUSE_OPCODES
+    InitializeFused();
+#endif
+
+#if HLE_ROUTINES
+    // sprite routines in C, checked against the ROM with headless -hle verify;
+    // they're at invaders.rom's addresses, so not for cpudiag, and the
+    // recompiled and threaded cores never stop at a routine's entry
+    InitializeHle();
+    if (!FOR_CPUDIAG && !RECOMPILED && !THREADED_CORE)
+    {
+        hle_mode = HLE_FAST;
+    }
+#endif
+
+#if RENDER_THREAD
+    RunWithRenderThread(window, renderer, state, export_name, run_ahead);
+
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    TTF_CloseFont(font);
+    TTF_Quit();
+    PhosphorRelease(&phosphor);
+    AudioClose();
+    SDL_Quit();
+    return 0;
+#endif
+
+#if SHARED_EXPORT
+    if (export_name && !ExportOpen(export_name))
+    {
+        printf("error: Couldn't set up the shared memory %s\n", export_name);
+    }
+#endif
 
     // -------------------------------------------------------
 
@@ -250,7 +747,7 @@ int main(int argc, char **argv)
 
     uint8_t r = 0;
 
-    if (r_port[1] >> 5 & 0x01)
+    if (machine_device.r_port[1] >> 5 & 0x01)
     {
         r = 255;
     }
@@ -263,7 +760,7 @@ int main(int argc, char **argv)
 
     r = 0;
 
-    if (r_port[1] >> 6 & 0x01)
+    if (machine_device.r_port[1] >> 6 & 0x01)
     {
         r = 255;
     }
@@ -275,7 +772,7 @@ int main(int argc, char **argv)
 
     r = 0;
 
-    if (r_port[1] >> 4 & 0x01)
+    if (machine_device.r_port[1] >> 4 & 0x01)
     {
         r = 255;
     }
@@ -286,98 +783,80 @@ int main(int argc, char **argv)
     text_texture_shoot = SDL_CreateTextureFromSurface(renderer, text_shoot);
 
     SDL_Rect states = {
-        0, 244, 256, 56};
+        0, VIDEO_HEIGHT * factor, 256 * factor, 56};
 
     // -------------------------------------------------------
 
-    int last_frame_time = SDL_GetTicks();
-
-    while (1)
+    // one frame per pass: all the pending events, a frame worth of cycles
+    // (MachineRunFrame, with both interrupts), one redraw and one present,
+    // then wait for the rest of the frame (pacer.c)
+    SDL_Texture *screen = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                            factor * VIDEO_WIDTH, factor * VIDEO_HEIGHT);
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+    uint64_t started = SDL_GetPerformanceCounter();
+    uint64_t start_cycles = state->cycles;
+    Pacer pacer;
+    Turbo turbo;
+    static RunAhead ahead;
+    LatencyProbe probe = {0};
+    const uint8_t *on_screen = state->memory + 0x2400;
+    long long pass_start = PacerNow();
+    clock_t start_cpu = clock();
+    bool running = true;
+
+    PacerInit(&pacer, state->cycles);
+    TurboInit(&turbo, RefreshRate(window));
+    ahead.frames = run_ahead;
+    uint32_t dirty[VIDEO_DIRTY_WORDS];
+    state->write_hook = VideoWriteHook;
+    AudioTurbo(state, FALSE);
+    while (running)
     {
-        // system("@cls||clear");
-
-        current_time = SDL_GetTicks();
-        elapsed_time = (current_time - last_frame_time);
-
-        // printf("Current time (ms): %d\n", current_time);
-        // printf("Elapsed time (ms): %d\n", elapsed_time);
-        // printf("Last frame time (ms): %d\n", last_frame_time);
-        // printf("Max elapsed time (ms): %d\n", max_elapsed);
-
-        uint8_t *code = &state->memory[state->pc];
-
-        int emul_time_start = SDL_GetTicks();
-
-        if (*code == 0xdb)
-        {
-            // implement IN
-            // printf("Running IN %02x\n", code[1]);
-            uint8_t port = code[1]; // the port is in the following byte
-
-            state->a = MachineIN(port, state->a); //
-            state->pc+=2;
-            state->cycles += 3;
-        }
-        else if (*code == 0xd3)
-        {
-            // implement out
-            // printf("Running OUT %02x\n", code[1]);
-            uint8_t port = code[1]; // the data is in the following byte
-
-            MachineOUT(port, state->a); // the value to be sent is stored in the accumulator before calling OUT
-            state->pc+=2;
-            state->cycles += 3;
-
-        }
-        else
-        {
-            opbytes = Emulate8080(state);
-            state->pc += opbytes;
-            instr_count++;
-            if (LOGS_CPU)
-            {
-                // system("@cls||clear");
-                printf("Instructions ran: %d\n", instr_count);
-                printf("Prev instructions: %02x\n", state->memory[state->pc - opbytes]);
-                printf("Current instructions: %02x\n", state->memory[state->pc]);
-                ShowState(state);
-            }
-            // system("@cls||clear");
-            // printf("Cycles: %d\n", state->cycles);
-            printf("%d\n", instr_count);
-            opbytes = 1;
-
-            // if (instr_count == 40000) exit(1);
-            // if (state->pc == 0xada) exit(1);
-
-        }
-
-        // printf("CPU time: %d\n", SDL_GetTicks() - emul_time_start);
-
-        if (SDL_PollEvent(&event))
+        while (SDL_PollEvent(&event))
         {
             if (SDL_QUIT == event.type)
             {
-                break;
+                running = false;
             }
 
             if (event.type == SDL_KEYDOWN)
             {
                 switch (event.key.keysym.scancode)
                 {
+                case SDL_SCANCODE_C:
+                    machine_device.r_port[1] |= 0x01; // coin
+                    break;
+                case SDL_SCANCODE_1:
+                    machine_device.r_port[1] |= 0x04; // 1 player start
+                    break;
                 case SDL_SCANCODE_SPACE:
-                    MachineKeyDown(1, 0x10);
-                    if (MANUAL_EXEC)
-                    {
-                        state->pc += opbytes;
-                        continue_exec = true;
-                    }
+                    machine_device.r_port[1] |= 0x10;
                     break;
                 case SDL_SCANCODE_LEFT:
-                    MachineKeyDown(1, 0x20);
+                    machine_device.r_port[1] |= 0x20;
+                    if (!event.key.repeat)
+                    {
+                        ProbeKey(&probe, on_screen);
+                    }
                     break;
                 case SDL_SCANCODE_RIGHT:
-                    MachineKeyDown(1, 0x40);
+                    machine_device.r_port[1] |= 0x40;
+                    if (!event.key.repeat)
+                    {
+                        ProbeKey(&probe, on_screen);
+                    }
+                    break;
+                case SDL_SCANCODE_TAB:
+                    if (!event.key.repeat)
+                    {
+                        TurboToggle(&turbo);
+                        TurboTitle(window, &turbo);
+                        // back to real time from wherever the machine got to
+                        PacerInit(&pacer, state->cycles);
+                        // run-ahead goes off or on, the screen jumps
+                        VideoDirtyAll();
+                        AudioTurbo(state, turbo.on);
+                    }
                     break;
                 }
             }
@@ -386,119 +865,116 @@ int main(int argc, char **argv)
             {
                 switch (event.key.keysym.scancode)
                 {
+                case SDL_SCANCODE_C:
+                    machine_device.r_port[1] &= 0xFE; // 0xFE = 0b11111110 which will set only bit 0 off
+                    break;
+                case SDL_SCANCODE_1:
+                    machine_device.r_port[1] &= 0xFB; // 0xFB = 0b11111011 which will set only bit 2 off
+                    break;
                 case SDL_SCANCODE_SPACE:
-                    MachineKeyUp(1, 0xEF); // 0xBF = 0b11101111 which will set only bit 4 off
+                    machine_device.r_port[1] &= 0xEF; // 0xEF = 0b11101111 which will set only bit 4 off
                     break;
                 case SDL_SCANCODE_LEFT:
-                    MachineKeyUp(1, 0xDF); // 0xDF = 0b11011111 which will set only bit 5 off
+                    machine_device.r_port[1] &= 0xDF; // 0xDF = 0b11011111 which will set only bit 5 off
                     break;
                 case SDL_SCANCODE_RIGHT:
-                    MachineKeyUp(1, 0xBF); // 0xBF = 0b10111111 which will set only bit 6 off
+                    machine_device.r_port[1] &= 0xBF; // 0xBF = 0b10111111 which will set only bit 6 off
                     break;
                 }
             }
         }
 
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderClear(renderer);
-
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-        SDL_RenderFillRect(renderer, &states);
-
-        // Get the current time
-        current_time = clock();
-
-        // Calculate the elapsed time in seconds
-        // elapsed_time = ((double)(current_time - start_time)) / CLOCKS_PER_SEC;
-
-        int i, j, k;
-        for (i = 0; i < 256; i++)
+        // fast-forwarding, turbo.frames of them for the one drawn, otherwise
+        // one, with run-ahead
+        unsigned long long instructions_before = instruction_count;
+        const uint8_t *vram = state->memory + 0x2400;
+        if (turbo.on)
         {
-            for (j = 0; j < 28; j++)
+            int frames = turbo.frames;
+            while (frames--)
             {
-                int offset = (i * 28) + j;
-                // printf("(%d, %d): %02x\n", i, j, state->memory[0x2400 + offset]);
-                uint8_t render_pixels;
-                if (FOR_CPUDIAG)
-                {
-                    render_pixels = state->memory[offset];
-                }
-                else
-                {
-                    render_pixels = state->memory[0x2400 + offset];
-                }
-
-                for (k = 0; k < 8; k++)
-                {
-                    uint8_t pixel_state = (render_pixels >> k) & 0x01;
-
-                    if (pixel_state)
-                    {
-                        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-                    }
-                    else
-                    {
-                        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-                    }
-
-                    SDL_RenderDrawPoint(renderer, i, j);
-                }
+                MachineRunFrame(state);
+                frame_count++;
             }
         }
-
-        frame_count++;
-
-        // printf("Elapsed time (ms): %d\n", elapsed_time);
-        if (elapsed_time >= 8.33 && elapsed_time < 16.67)
+        else
         {
-            // Generate the VBlank interrupt or perform the action here
-            if (state->int_enabled)
-            {
-                Interrupt(state, 1);
-                opbytes = 1;
-                printf("Mid screen interrupt generated\n");
-            }
+            vram = RunAheadFrame(&ahead, state);
+            AudioFrame(state);
+            frame_count++;
         }
 
-        if (elapsed_time >= 16.67)
+        if (LOGS_CPU)
         {
-            // Generate the VBlank interrupt or perform the action here
-
-            // Reset the start time to the current time for the next loop
-            last_frame_time = current_time;
+            printf("Instructions ran: %llu\n", instruction_count - instructions_before);
+            ShowState(state);
+        }
 
-            if (elapsed_time > max_elapsed)
-            {
-                max_elapsed = elapsed_time;
-            }
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderClear(renderer);
 
-            if (state->int_enabled)
-            {
-                Interrupt(state, 2);
-                opbytes = 1;
-                printf("VBL interrupt generated\n");
-            }
+        // only the columns written to since the last pass
+        VideoTakeDirty(dirty);
+        if (FOR_CPUDIAG)
+        {
+            // the diagnostic's memory from 0, all of it every time
+            memset(dirty, 0xff, sizeof(dirty));
+            DrawDirty(screen, state->memory, dirty);
         }
+        else
+        {
+            DrawDirty(screen, vram, dirty);
+            DirtyStatsAdd(&dirty_stats, dirty, state->memory[0x20ef]); // gameMode
+        }
+        SDL_RenderCopy(renderer, screen, NULL, &(SDL_Rect){(256 - VIDEO_WIDTH) * factor / 2, 0, VIDEO_WIDTH * factor, VIDEO_HEIGHT * factor});
 
-        SDL_RenderCopy(renderer, text_texture_l, NULL, &(SDL_Rect){0, 244, text_l->w, text_l->h});
-        SDL_RenderCopy(renderer, text_texture_r, NULL, &(SDL_Rect){text_l->w + 10, 244, text_r->w, text_r->h});
-        SDL_RenderCopy(renderer, text_texture_shoot, NULL, &(SDL_Rect){0, 244 + text_l->h + 5, text_shoot->w, text_shoot->h});
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        SDL_RenderFillRect(renderer, &states);
+
+        SDL_RenderCopy(renderer, text_texture_l, NULL, &(SDL_Rect){0, states.y, text_l->w, text_l->h});
+        SDL_RenderCopy(renderer, text_texture_r, NULL, &(SDL_Rect){text_l->w + 10, states.y, text_r->w, text_r->h});
+        SDL_RenderCopy(renderer, text_texture_shoot, NULL, &(SDL_Rect){0, states.y + text_l->h + 5, text_shoot->w, text_shoot->h});
 
         SDL_RenderPresent(renderer);
+        on_screen = vram;
+        ProbePresented(&probe, on_screen);
 
-        // printf("Render time: %d\n", SDL_GetTicks() - emul_time_start);
+        // rest of the frame, or when fast-forwarding, how many for the next pass
+        if (turbo.on)
+        {
+            long long now = PacerNow();
+            TurboAdapt(&turbo, now - pass_start);
+            pass_start = now;
+        }
+        else
+        {
+            PacerWait(&pacer, state->cycles);
+            pass_start = PacerNow();
+        }
+        if (TurboMeasure(&turbo, frame_count) && turbo.on)
+        {
+            TurboTitle(window, &turbo);
+        }
 
         if (LOGS_MACHINE)
         {
             system("@cls||clear");
 
-            printf("Port 1 %02x\n", r_port[1]);
-            printf("Time %.4f\n", elapsed_time);
-            printf("Max elapsed %.4f\n", max_elapsed);
+            printf("Port 1 %02x\n", machine_device.r_port[1]);
             printf("Frames displayed %d\n", frame_count);
         }
     }
 
+    // host CPU used against wall time, and how fast the machine went
+    double wall_seconds = (double)(SDL_GetPerformanceCounter() - started) / frequency;
+    double cpu_seconds = (double)(clock() - start_cpu) / CLOCKS_PER_SEC;
+    printf("Frames: %d in %.1f s, %.3f emulated MHz, host CPU %.0f%%\n", frame_count, wall_seconds,
+           (state->cycles - start_cycles) / wall_seconds / 1e6, 100 * cpu_seconds / wall_seconds);
+    PacerReport(&pacer);
+    HistogramPrint(&key_latency);
+    DirtyStatsPrint(&dirty_stats);
+
+    SDL_DestroyTexture(screen);
     SDL_DestroyTexture(text_texture_l);
     SDL_DestroyTexture(text_texture_r);
     SDL_DestroyTexture(text_texture_shoot);
@@ -510,6 +986,15 @@ int main(int argc, char **argv)
     SDL_DestroyWindow(window);
     TTF_CloseFont(font);
     TTF_Quit();
+    PhosphorRelease(&phosphor);
+    AudioClose();
+#if SHARED_EXPORT
+    if (export_name)
+    {
+        ExportClose();
+        ExportRemove(export_name);
+    }
+#endif
     SDL_Quit();
     return 0;
 }
\ No newline at end of file
@@ -1,10 +1,70 @@
 #define TRUE 1
 #define FALSE 0
 
+// the headless tools override these from the Makefile (-DLOGS_CPU=0 ...)
+#ifndef LOGS_CPU
 #define LOGS_CPU 1
+#endif
 #define LOGS_MACHINE 0
 
 
 #define MANUAL_EXEC 0
 
-#define FOR_CPUDIAG 1
\ No newline at end of file
+#ifndef FOR_CPUDIAG
+#define FOR_CPUDIAG 1
+#endif
+
+// count dynamic opcode bigrams/trigrams and write the most frequent ones to fused_ops.h
+#ifndef PROFILE_OPCODES
+#define PROFILE_OPCODES 0
+#endif
+
+// run the sequences listed in fused_ops.h as a single dispatch (superinstructions)
+#ifndef FUSE_OPCODES
+#define FUSE_OPCODES 0
+#endif
+
+// native replacements for known ROM routines (hle.c), switched on at run time
+#ifndef HLE_ROUTINES
+#define HLE_ROUTINES 1
+#endif
+
+// run the game from recompiled.c (generated by 8080recompiler) instead of the interpreter
+#ifndef RECOMPILED
+#define RECOMPILED 0
+#endif
+
+// tail-call threaded interpreter (threaded.c) instead of the switch in Emulate8080
+#ifndef THREADED_CORE
+#define THREADED_CORE 0
+#endif
+
+// run the game's block copy/fill loops as memmove/memset (idiom.c); off with
+// the recompiled and threaded cores, which only go through MachineStep for
+// code they don't cover, so it would hardly ever get the chance
+#ifndef IDIOM_LOOPS
+#define IDIOM_LOOPS !(RECOMPILED || THREADED_CORE)
+#endif
+
+// keep a hash of the whole memory up to date on every write (MachineStateHash)
+#ifndef STATE_HASH
+#define STATE_HASH 1
+#endif
+
+// storage class of the machine layer globals (counters, deadline, HLE scratch),
+// per thread so env.c can run machines on several threads at once
+#ifndef MACHINE_LOCAL
+#define MACHINE_LOCAL _Thread_local
+#endif
+
+// publish the video RAM, registers and ports in shared memory at every VBlank
+// (export.c), once ExportOpen is called
+#ifndef SHARED_EXPORT
+#define SHARED_EXPORT 1
+#endif
+
+// SpaceInvaders.c: emulation on its own thread, frames handed to the render
+// thread through a triple buffer (video.c)
+#ifndef RENDER_THREAD
+#define RENDER_THREAD 1
+#endif
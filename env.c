@@ -0,0 +1,437 @@
+#include <pthread.h>
+
+// Batched environment for reinforcement learning: N headless Space Invaders
+// machines stepped together, spread over a pool of threads.
+//
+//   EnvPool pool;
+//   EnvPoolInit(&pool, rom, rom_size, count, threads, frameskip, seed);
+//   EnvReset(&pool, observations);
+//   EnvStep(&pool, actions, observations, rewards, dones);   // over and over
+//   EnvPoolRelease(&pool);
+//
+// The caller owns the buffers: observations is count * pool.observation_size
+// bytes (by default the video RAM of each machine, one after the other),
+// actions, rewards and dones have one entry per machine. Nothing gets allocated
+// once the pool is set up.
+//
+// Each machine starts from the same snapshot, taken right after a coin and
+// 1P start, then runs a random number (from seed) of frames doing nothing so
+// the episodes don't all play out the same. The reward is the score gained
+// during the step, from the BCD score in RAM, and done is set when the game
+// goes back to attract mode (game over). A machine that is done is reset
+// within the same step, and its observation is the first one of the new game.
+//
+// With EnvPoolObserve, the observation is a downsampled grayscale image instead
+// (observe.c), max-pooled over the last two frames of the step, as uint8 or
+// float, in a stack of the last few ones: each machine's share of the buffer is
+// a ring of depth images, EnvObservation tells which slot has which.
+//
+// Needs fork.c (a machine is a MachineFork with its own device, see
+// ForkRunFrames), observe.c and the machine layer globals being per thread
+// (MACHINE_LOCAL in constants.h).
+
+#define ENV_MAX_THREADS 64
+
+// the video RAM, 1 bit per pixel, 224 columns of 256 pixels
+#define ENV_OBSERVATION_SIZE 0x1c00
+
+// at most this many frames doing nothing after a reset
+#define ENV_NOOP_FRAMES 30
+
+// where the game keeps what the environment looks at
+#define ENV_GAME_MODE 0x20ef   // 1 while a game is played, 0 in attract mode
+#define ENV_SCORE_P1 0x20f8    // player 1 score, 4 BCD digits, low byte first
+#define ENV_VIDEO_RAM 0x2400
+
+enum
+{
+    ENV_NOOP,
+    ENV_FIRE,
+    ENV_RIGHT,
+    ENV_LEFT,
+    ENV_RIGHT_FIRE,
+    ENV_LEFT_FIRE,
+    ENV_ACTIONS
+};
+
+// port 1 bits: fire, left, right
+uint8_t env_action_inputs[ENV_ACTIONS] = {0x00, 0x10, 0x40, 0x20, 0x50, 0x30};
+
+typedef struct Env
+{
+    MachineFork machine;
+    int score;
+    uint32_t random;
+
+    // video RAM one frame before the end of the step, for the max-pooling
+    uint8_t previous[ENV_OBSERVATION_SIZE];
+} Env;
+
+typedef struct EnvWorker
+{
+    struct EnvPool *pool;
+    int index;
+    pthread_t thread;
+} EnvWorker;
+
+typedef struct EnvPool
+{
+    int count;
+    int threads;
+    int frameskip;
+    Env *envs;
+    uint8_t *memory; // count * ADDRESS_SPACE, one block for all the machines
+
+    // where every machine starts from
+    MachineFork start;
+    uint8_t *start_memory;
+
+    // what goes in the observations: the video RAM (observing FALSE), or stacks of
+    // downsampled frames, the stack telling which slot is the newest
+    int observing;
+    int as_float;
+    Observe observe;
+    ObserveStack stack;
+    int observation_size; // bytes per machine
+
+    // the job all the threads run between the two barriers
+    enum
+    {
+        ENV_JOB_RESET,
+        ENV_JOB_STEP,
+        ENV_JOB_QUIT
+    } job;
+    const uint8_t *actions;
+    uint8_t *observations;
+    int *rewards;
+    uint8_t *dones;
+
+    EnvWorker workers[ENV_MAX_THREADS];
+    pthread_mutex_t starting; // held while the threads are being started
+    pthread_barrier_t start_barrier;
+    pthread_barrier_t done_barrier;
+} EnvPool;
+
+int EnvBcd(uint8_t value)
+{
+    return (value >> 4) * 10 + (value & 0x0f);
+}
+
+int EnvScore(Env *env)
+{
+    uint8_t *memory = env->machine.state.memory;
+    return EnvBcd(memory[ENV_SCORE_P1 + 1]) * 100 + EnvBcd(memory[ENV_SCORE_P1]);
+}
+
+// xorshift32, one sequence per machine
+uint32_t EnvRandom(Env *env)
+{
+    uint32_t x = env->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    env->random = x;
+    return x;
+}
+
+void EnvResetOne(EnvPool *pool, Env *env)
+{
+    uint8_t *memory = env->machine.state.memory;
+    int frames = EnvRandom(env) % (ENV_NOOP_FRAMES + 1);
+
+    env->machine = pool->start;
+    env->machine.state.memory = memory;
+    memcpy(memory, pool->start_memory, ADDRESS_SPACE);
+
+    ForkRunFrames(&env->machine, frames);
+    env->score = EnvScore(env);
+}
+
+// One step of one machine: the action held for frameskip frames (fire only for
+// the first half, the game wants it released before it fires again)
+void EnvStepOne(EnvPool *pool, Env *env, uint8_t action, int *reward, uint8_t *done)
+{
+    uint8_t input = env_action_inputs[action < ENV_ACTIONS ? action : ENV_NOOP];
+    int frame;
+
+    for (frame = 0; frame < pool->frameskip; frame++)
+    {
+        if (pool->observing && frame == pool->frameskip - 1)
+        {
+            memcpy(env->previous, env->machine.state.memory + ENV_VIDEO_RAM, ENV_OBSERVATION_SIZE);
+        }
+        env->machine.device.r_port[1] = (frame < (pool->frameskip + 1) / 2) ? input : (input & ~0x10);
+        ForkRunFrames(&env->machine, 1);
+    }
+    env->machine.device.r_port[1] = 0;
+
+    int score = EnvScore(env);
+    // the counter has 4 digits and goes from 9990 back to 0000
+    *reward = (score - env->score + 10000) % 10000;
+    env->score = score;
+
+    *done = env->machine.state.memory[ENV_GAME_MODE] == 0;
+    if (*done)
+    {
+        EnvResetOne(pool, env);
+    }
+}
+
+// Writes the observation of machine i into the newest slot of its stack, or
+// into all of them after a reset
+void EnvObserve(EnvPool *pool, Env *env, int i, int reset)
+{
+    uint8_t *vram = env->machine.state.memory + ENV_VIDEO_RAM;
+    uint8_t *out = pool->observations + (size_t)i * pool->observation_size;
+
+    if (!pool->observing)
+    {
+        memcpy(out, vram, ENV_OBSERVATION_SIZE);
+        return;
+    }
+
+    ObserveStack stack = pool->stack;
+    stack.frames = out;
+
+    uint8_t *newest = ObserveStackFrame(&stack, 0);
+    if (pool->as_float)
+    {
+        ObserveGrayFloat(&pool->observe, vram, reset ? NULL : env->previous, (float *)newest);
+    }
+    else
+    {
+        ObserveGray(&pool->observe, vram, reset ? NULL : env->previous, newest);
+    }
+
+    if (reset)
+    {
+        int age;
+        for (age = 1; age < stack.depth; age++)
+        {
+            memcpy(ObserveStackFrame(&stack, age), newest, stack.size);
+        }
+    }
+}
+
+// the machines of one thread, a contiguous share of them
+void EnvWork(EnvPool *pool, int worker)
+{
+    int first = worker * pool->count / pool->threads;
+    int last = (worker + 1) * pool->count / pool->threads;
+    int i;
+
+    for (i = first; i < last; i++)
+    {
+        Env *env = &pool->envs[i];
+
+        if (pool->job == ENV_JOB_RESET)
+        {
+            EnvResetOne(pool, env);
+            EnvObserve(pool, env, i, TRUE);
+        }
+        else
+        {
+            EnvStepOne(pool, env, pool->actions[i], &pool->rewards[i], &pool->dones[i]);
+            EnvObserve(pool, env, i, pool->dones[i]);
+        }
+    }
+}
+
+void *EnvThread(void *arg)
+{
+    EnvWorker *worker = (EnvWorker *)arg;
+    EnvPool *pool = worker->pool;
+
+    // the barriers aren't there until every thread is started
+    pthread_mutex_lock(&pool->starting);
+    pthread_mutex_unlock(&pool->starting);
+
+    while (1)
+    {
+        pthread_barrier_wait(&pool->start_barrier);
+        if (pool->job == ENV_JOB_QUIT)
+        {
+            return NULL;
+        }
+        EnvWork(pool, worker->index);
+        pthread_barrier_wait(&pool->done_barrier);
+    }
+}
+
+// the calling thread is worker 0, the others wait at the start barrier
+void EnvRunJob(EnvPool *pool)
+{
+    pthread_barrier_wait(&pool->start_barrier);
+    EnvWork(pool, 0);
+    pthread_barrier_wait(&pool->done_barrier);
+}
+
+// Boots the game from rom up to the start of a 1 player game, for the snapshot.
+// Returns FALSE if the game never started
+int EnvBoot(EnvPool *pool, uint8_t *rom, int rom_size)
+{
+    State8080 *state = &pool->start.state;
+    int frame;
+
+    InitializeRegisters(state);
+    memset(&pool->start.device, 0, sizeof(MachineDevice));
+    state->memory = pool->start_memory;
+    state->cycles = 0;
+    memcpy(state->memory, rom, rom_size);
+    HashMemory(state);
+
+    for (frame = 0; frame < 600; frame++)
+    {
+        // coin, then 1P start
+        pool->start.device.r_port[1] = (frame >= 100 && frame < 105) ? 0x01 : (frame >= 200 && frame < 205) ? 0x04 : 0x00;
+        ForkRunFrames(&pool->start, 1);
+
+        if (frame >= 205 && state->memory[ENV_GAME_MODE] == 1)
+        {
+            pool->start.device.r_port[1] = 0;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// the buffers, when the pool is released or EnvPoolInit gives up
+void EnvPoolFree(EnvPool *pool)
+{
+    free(pool->envs);
+    free(pool->memory);
+    free(pool->start_memory);
+    pool->envs = NULL;
+    pool->memory = NULL;
+    pool->start_memory = NULL;
+}
+
+// Stops the threads and frees everything
+void EnvPoolRelease(EnvPool *pool)
+{
+    int i;
+
+    pool->job = ENV_JOB_QUIT;
+    pthread_barrier_wait(&pool->start_barrier);
+    for (i = 1; i < pool->threads; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    pthread_barrier_destroy(&pool->start_barrier);
+    pthread_barrier_destroy(&pool->done_barrier);
+    pthread_mutex_destroy(&pool->starting);
+
+    EnvPoolFree(pool);
+}
+
+// Sets up count machines on threads threads (the caller's one included).
+// Returns FALSE, with nothing left allocated or running, if something couldn't
+// be allocated, a thread couldn't be started or the game didn't start
+int EnvPoolInit(EnvPool *pool, uint8_t *rom, int rom_size, int count, int threads, int frameskip, uint32_t seed)
+{
+    int i;
+
+    memset(pool, 0, sizeof(EnvPool));
+    if (count < 1 || rom_size > MEMORY_SIZE)
+    {
+        return FALSE;
+    }
+
+    pool->count = count;
+    pool->threads = (threads < 1) ? 1 : (threads > ENV_MAX_THREADS) ? ENV_MAX_THREADS : threads;
+    if (pool->threads > count)
+    {
+        pool->threads = count;
+    }
+    pool->frameskip = (frameskip < 1) ? 1 : frameskip;
+    pool->observation_size = ENV_OBSERVATION_SIZE;
+    ObserveStackInit(&pool->stack, NULL, 1, ENV_OBSERVATION_SIZE);
+
+    pool->envs = (Env *)calloc(count, sizeof(Env));
+    pool->memory = (uint8_t *)calloc(count, ADDRESS_SPACE);
+    pool->start_memory = (uint8_t *)calloc(1, ADDRESS_SPACE);
+    if (!pool->envs || !pool->memory || !pool->start_memory || !EnvBoot(pool, rom, rom_size))
+    {
+        EnvPoolFree(pool);
+        return FALSE;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        pool->envs[i].machine.state.memory = pool->memory + (size_t)i * ADDRESS_SPACE;
+        pool->envs[i].random = (seed + i) * 2654435761u | 1;
+    }
+
+    // if a thread can't be started, the barriers are made for the ones that
+    // were and EnvPoolRelease stops them
+    pthread_mutex_init(&pool->starting, NULL);
+    pthread_mutex_lock(&pool->starting);
+    for (i = 1; i < pool->threads; i++)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->workers[i].thread, NULL, EnvThread, &pool->workers[i]) != 0)
+        {
+            break;
+        }
+    }
+    int started = (i == pool->threads);
+    pool->threads = i;
+
+    pthread_barrier_init(&pool->start_barrier, NULL, pool->threads);
+    pthread_barrier_init(&pool->done_barrier, NULL, pool->threads);
+    pthread_mutex_unlock(&pool->starting);
+
+    if (!started)
+    {
+        EnvPoolRelease(pool);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Switches the observations to width x height grayscale images (floats from 0 to
+// 1 if as_float), depth of them per machine. Returns FALSE if the size isn't one
+// observe.c supports
+int EnvPoolObserve(EnvPool *pool, int width, int height, int depth, int as_float)
+{
+    if (depth < 1 || !ObserveInit(&pool->observe, width, height))
+    {
+        return FALSE;
+    }
+
+    pool->observing = TRUE;
+    pool->as_float = as_float;
+    ObserveStackInit(&pool->stack, NULL, depth, width * height * (as_float ? sizeof(float) : 1));
+    pool->observation_size = depth * pool->stack.size;
+    return TRUE;
+}
+
+// Observation of machine i, age steps ago (0 for the latest), in the buffer
+// given to the last EnvReset or EnvStep
+uint8_t *EnvObservation(EnvPool *pool, uint8_t *observations, int i, int age)
+{
+    ObserveStack stack = pool->stack;
+    stack.frames = observations + (size_t)i * pool->observation_size;
+    return ObserveStackFrame(&stack, age);
+}
+
+// Starts a new game on every machine
+void EnvReset(EnvPool *pool, uint8_t *observations)
+{
+    pool->job = ENV_JOB_RESET;
+    pool->observations = observations;
+    EnvRunJob(pool);
+}
+
+// One step of every machine, actions[i] being one of the ENV_ actions
+void EnvStep(EnvPool *pool, const uint8_t *actions, uint8_t *observations, int *rewards, uint8_t *dones)
+{
+    pool->job = ENV_JOB_STEP;
+    ObserveStackPush(&pool->stack);
+    pool->actions = actions;
+    pool->observations = observations;
+    pool->rewards = rewards;
+    pool->dones = dones;
+    EnvRunJob(pool);
+}
@@ -0,0 +1,238 @@
+#include <stdatomic.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Shared memory export: at every VBlank the machine publishes its video RAM,
+// registers and port latches in a named shared memory region (POSIX shm_open,
+// a named file mapping on Windows) that other processes can map.
+//
+// The region has two slots, each with a sequence number (a seqlock). The
+// writer fills the slot the readers aren't pointed at, making its sequence odd
+// while it writes and even again after, then points latest at it. It never
+// waits for anybody. A reader looks at the latest slot in place, no copy, and
+// checks afterwards that its sequence didn't move: if it did, the writer came
+// around to that slot again meanwhile and what was read has to be thrown away.
+//
+//   ExportOpen("/invaders")                    emulator side, publishes from then on
+//   ExportAttach("/invaders")                  reader side
+//   frame = ExportReadBegin(region, &ticket)   NULL if nothing was published yet
+//   ... use frame ...
+//   ExportReadValid(region, ticket)            FALSE: frame was torn, drop it
+
+#define EXPORT_MAGIC 0x30383038 // "8080"
+#define EXPORT_VERSION 1
+
+typedef struct ExportFrame
+{
+    uint32_t frame; // VBlanks since ExportOpen
+    uint32_t cycles;
+
+    uint8_t a, b, c, d, e, h, l;
+    uint8_t flags; // S Z 0 AC 0 P 1 CY, as PUSH PSW puts them
+    uint16_t sp, pc;
+    uint8_t int_enabled;
+
+    uint8_t shift_hi, shift_lo, shift_offset;
+    uint8_t r_port[4];
+    uint8_t w_port[7];
+
+    uint8_t vram[0x1c00];
+} ExportFrame;
+
+typedef struct ExportSlot
+{
+    _Atomic uint32_t sequence; // odd while the writer is in the slot
+    ExportFrame frame;
+} ExportSlot;
+
+typedef struct ExportRegion
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    _Atomic uint32_t latest; // slot of the last complete frame, ~0 before the first
+    ExportSlot slot[2];
+} ExportRegion;
+
+// What a reader got from ExportReadBegin, to check with ExportReadValid
+typedef struct ExportTicket
+{
+    uint32_t slot;
+    uint32_t sequence;
+} ExportTicket;
+
+// region this thread publishes to at every VBlank, NULL when not exporting
+MACHINE_LOCAL ExportRegion *export_region = NULL;
+MACHINE_LOCAL uint32_t export_frames = 0;
+
+// Maps the region called name, creating it if create. Returns NULL on failure
+ExportRegion *ExportMap(const char *name, int create)
+{
+    void *memory;
+
+#ifdef _WIN32
+    HANDLE mapping = create ? CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(ExportRegion), name)
+                            : OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+    if (mapping == NULL)
+    {
+        return NULL;
+    }
+    // the view keeps the mapping alive
+    memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(ExportRegion));
+    CloseHandle(mapping);
+    if (memory == NULL)
+    {
+        return NULL;
+    }
+#else
+    int fd = shm_open(name, create ? (O_CREAT | O_RDWR) : O_RDWR, 0600);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if (create && ftruncate(fd, sizeof(ExportRegion)) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    memory = mmap(NULL, sizeof(ExportRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        return NULL;
+    }
+#endif
+
+    return (ExportRegion *)memory;
+}
+
+// Starts publishing from this thread into the region called name ("/invaders"
+// for shm_open, "Local\invaders" on Windows). Returns FALSE if it couldn't be set up
+int ExportOpen(const char *name)
+{
+    ExportRegion *region = ExportMap(name, TRUE);
+
+    if (region == NULL)
+    {
+        return FALSE;
+    }
+
+    memset(region, 0, sizeof(ExportRegion));
+    region->magic = EXPORT_MAGIC;
+    region->version = EXPORT_VERSION;
+    region->size = sizeof(ExportRegion);
+    atomic_store_explicit(&region->latest, ~0u, memory_order_release);
+
+    export_region = region;
+    export_frames = 0;
+    return TRUE;
+}
+
+// Stops publishing. On POSIX the name stays around until ExportRemove
+void ExportClose()
+{
+    if (export_region == NULL)
+    {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(export_region);
+#else
+    munmap(export_region, sizeof(ExportRegion));
+#endif
+    export_region = NULL;
+}
+
+void ExportRemove(const char *name)
+{
+#ifndef _WIN32
+    shm_unlink(name);
+#endif
+}
+
+// Writer side, called at VBlank
+void ExportPublish(ExportRegion *region, State8080 *state)
+{
+    MachineDevice *device = MachineDeviceOf(state);
+    ShiftRegister *shift = &device->shift;
+    uint32_t latest = atomic_load_explicit(&region->latest, memory_order_relaxed);
+    uint32_t next = (latest == 0) ? 1 : 0;
+    ExportSlot *slot = &region->slot[next];
+    ExportFrame *frame = &slot->frame;
+    uint32_t sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    frame->frame = export_frames++;
+    frame->cycles = state->cycles;
+    frame->a = state->a;
+    frame->b = state->b;
+    frame->c = state->c;
+    frame->d = state->d;
+    frame->e = state->e;
+    frame->h = state->h;
+    frame->l = state->l;
+    frame->flags = (state->cc.s << 7) | (state->cc.z << 6) | (state->cc.ac << 4) | (state->cc.p << 2) | (1 << 1) | state->cc.cy;
+    frame->sp = state->sp;
+    frame->pc = state->pc;
+    frame->int_enabled = state->int_enabled;
+    frame->shift_hi = shift->shift_reg_hi;
+    frame->shift_lo = shift->shift_reg_lo;
+    frame->shift_offset = shift->shift_offset;
+    memcpy(frame->r_port, device->r_port, sizeof(frame->r_port));
+    memcpy(frame->w_port, device->w_port, sizeof(frame->w_port));
+    memcpy(frame->vram, state->memory + 0x2400, sizeof(frame->vram));
+
+    atomic_store_explicit(&slot->sequence, sequence + 2, memory_order_release);
+    atomic_store_explicit(&region->latest, next, memory_order_release);
+}
+
+// Reader side: maps an existing region, NULL if there is none or it's not ours
+ExportRegion *ExportAttach(const char *name)
+{
+    ExportRegion *region = ExportMap(name, FALSE);
+
+    if (region && (region->magic != EXPORT_MAGIC || region->version != EXPORT_VERSION || region->size != sizeof(ExportRegion)))
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(region);
+#else
+        munmap(region, sizeof(ExportRegion));
+#endif
+        return NULL;
+    }
+    return region;
+}
+
+// The latest frame, in place. NULL if there is none yet, or the writer is
+// already back in that slot (try again)
+const ExportFrame *ExportReadBegin(ExportRegion *region, ExportTicket *ticket)
+{
+    ticket->slot = atomic_load_explicit(&region->latest, memory_order_acquire);
+    if (ticket->slot > 1)
+    {
+        return NULL;
+    }
+
+    ticket->sequence = atomic_load_explicit(&region->slot[ticket->slot].sequence, memory_order_acquire);
+    if (ticket->sequence & 1)
+    {
+        return NULL;
+    }
+    return &region->slot[ticket->slot].frame;
+}
+
+// TRUE if the frame from ExportReadBegin wasn't written over while it was used
+int ExportReadValid(ExportRegion *region, ExportTicket ticket)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&region->slot[ticket.slot].sequence, memory_order_relaxed) == ticket.sequence;
+}
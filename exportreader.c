@@ -0,0 +1,100 @@
+#include "machine.c"
+#include <time.h>
+
+// Reads the frames a running SpaceInvaders or headless publishes with -export
+// (export.c), straight from the shared memory, and reports what it saw.
+//
+//   exportreader [name] [seconds]
+
+// between polls when there's nothing new: a frame comes every 16.7 ms,
+// so a quarter of a millisecond late costs nothing and frees the core
+void Backoff()
+{
+    struct timespec pause = {0, 250000};
+    nanosleep(&pause, NULL);
+}
+
+double Now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = (argc > 1) ? argv[1] : "/invaders";
+    double seconds = (argc > 2) ? atof(argv[2]) : 5;
+
+    ExportRegion *region = ExportAttach(name);
+
+    if (region == NULL)
+    {
+        printf("error: No exported machine at %s\n", name);
+        exit(1);
+    }
+
+    unsigned long long torn = 0, frames_seen = 0, frames_skipped = 0;
+    uint32_t last_frame = 0;
+    int have_frame = FALSE;
+    int lit = 0;
+    uint16_t pc = 0, sp = 0;
+    uint8_t a = 0, port = 0;
+    double end = Now() + seconds;
+
+    while (Now() < end)
+    {
+        ExportTicket ticket;
+        const ExportFrame *frame = ExportReadBegin(region, &ticket);
+
+        if (frame == NULL)
+        {
+            Backoff();
+            continue;
+        }
+
+        uint32_t number = frame->frame;
+        if (have_frame && number == last_frame)
+        {
+            Backoff();
+            continue;
+        }
+
+        // the work on the frame, in place
+        int count = 0, i;
+        for (i = 0; i < (int)sizeof(frame->vram); i++)
+        {
+            count += __builtin_popcount(frame->vram[i]);
+        }
+        uint16_t frame_pc = frame->pc, frame_sp = frame->sp;
+        uint8_t frame_a = frame->a, frame_port = frame->r_port[1];
+
+        if (!ExportReadValid(region, ticket))
+        {
+            torn++;
+            continue;
+        }
+
+        if (have_frame)
+        {
+            frames_skipped += number - last_frame - 1;
+        }
+        frames_seen++;
+        last_frame = number;
+        have_frame = TRUE;
+        lit = count;
+        pc = frame_pc;
+        sp = frame_sp;
+        a = frame_a;
+        port = frame_port;
+    }
+
+    printf("Frames read: %llu, skipped (published while busy): %llu, torn and dropped: %llu\n",
+           frames_seen, frames_skipped, torn);
+    if (have_frame)
+    {
+        printf("Last frame %u: PC %04x SP %04x A %02x, port 1 %02x, %d pixels lit\n",
+               last_frame, pc, sp, a, port, lit);
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+// memfd_create needs _GNU_SOURCE, defined before the first include (see headless.c)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Copy-on-write forks of a running machine.
+// ForkSnapshot puts the memory of a machine in a shared memory object once,
+// then each ForkMachine maps it privately: every fork starts out sharing all of
+// its pages with the snapshot, and the OS only copies a page the first time a
+// fork writes into it. The registers and the board's device (shift register,
+// ports) are small and just copied.
+
+typedef struct MachineSnapshot
+{
+    State8080 state;
+    MachineDevice device;
+
+#ifdef _WIN32
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+} MachineSnapshot;
+
+typedef struct MachineFork
+{
+    State8080 state;
+    MachineDevice device;
+} MachineFork;
+
+// Takes a snapshot of state and of its device. Returns FALSE if the shared
+// memory couldn't be set up
+int ForkSnapshot(MachineSnapshot *snapshot, State8080 *state)
+{
+    snapshot->state = *state;
+    snapshot->state.memory = NULL;
+    snapshot->device = *MachineDeviceOf(state);
+    snapshot->device.sound = NULL;
+
+#ifdef _WIN32
+    snapshot->mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, ADDRESS_SPACE, NULL);
+    if (snapshot->mapping == NULL)
+    {
+        return FALSE;
+    }
+
+    uint8_t *shared = (uint8_t *)MapViewOfFile(snapshot->mapping, FILE_MAP_WRITE, 0, 0, ADDRESS_SPACE);
+    if (shared == NULL)
+    {
+        CloseHandle(snapshot->mapping);
+        return FALSE;
+    }
+    memcpy(shared, state->memory, ADDRESS_SPACE);
+    UnmapViewOfFile(shared);
+#else
+    snapshot->fd = memfd_create("8080 snapshot", 0);
+    if (snapshot->fd < 0)
+    {
+        return FALSE;
+    }
+
+    if (ftruncate(snapshot->fd, ADDRESS_SPACE) != 0 ||
+        pwrite(snapshot->fd, state->memory, ADDRESS_SPACE, 0) != ADDRESS_SPACE)
+    {
+        close(snapshot->fd);
+        return FALSE;
+    }
+#endif
+
+    return TRUE;
+}
+
+void ForkSnapshotRelease(MachineSnapshot *snapshot)
+{
+#ifdef _WIN32
+    CloseHandle(snapshot->mapping);
+#else
+    close(snapshot->fd);
+#endif
+}
+
+// A new machine starting from the snapshot, its memory shared copy-on-write.
+// Returns FALSE if the memory couldn't be mapped
+int ForkMachine(MachineFork *fork, MachineSnapshot *snapshot)
+{
+    fork->state = snapshot->state;
+    fork->device = snapshot->device;
+    MachineConnect(&fork->state, &fork->device);
+
+#ifdef _WIN32
+    fork->state.memory = (uint8_t *)MapViewOfFile(snapshot->mapping, FILE_MAP_COPY, 0, 0, ADDRESS_SPACE);
+    return fork->state.memory != NULL;
+#else
+    void *memory = mmap(NULL, ADDRESS_SPACE, PROT_READ | PROT_WRITE, MAP_PRIVATE, snapshot->fd, 0);
+    if (memory == MAP_FAILED)
+    {
+        fork->state.memory = NULL;
+        return FALSE;
+    }
+    fork->state.memory = (uint8_t *)memory;
+    return TRUE;
+#endif
+}
+
+void ForkRelease(MachineFork *fork)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(fork->state.memory);
+#else
+    munmap(fork->state.memory, ADDRESS_SPACE);
+#endif
+    fork->state.memory = NULL;
+}
+
+// Runs the fork on its own device, wherever the MachineFork was copied to
+void ForkRunFrames(MachineFork *fork, int frames)
+{
+    int frame;
+
+    MachineConnect(&fork->state, &fork->device);
+    for (frame = 0; frame < frames; frame++)
+    {
+        MachineRunFrame(&fork->state);
+    }
+}
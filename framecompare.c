@@ -0,0 +1,76 @@
+#include "constants.h"
+#include "framelog.c"
+#include <stdlib.h>
+
+// Compares two frame hash logs (framelog.c, headless -framelog) and reports
+// the first frame where the screens differ. Exits with 0 if they're the same
+// frame for frame, 1 if not, 2 if a log can't be read.
+//
+//   framecompare before.crc after.crc
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        printf("usage: framecompare a.crc b.crc\n");
+        return 2;
+    }
+
+    FILE *a = FrameLogOpenRead(argv[1]);
+    FILE *b = FrameLogOpenRead(argv[2]);
+
+    if (a == NULL || b == NULL)
+    {
+        printf("error: %s isn't a frame log\n", a == NULL ? argv[1] : argv[2]);
+        return 2;
+    }
+
+    long frame = 0, first = -1, differing = 0;
+    uint32_t crc_a, crc_b, first_a = 0, first_b = 0;
+    int more_a, more_b;
+
+    while ((more_a = FrameLogRead(a, &crc_a)) & (more_b = FrameLogRead(b, &crc_b)))
+    {
+        if (crc_a != crc_b)
+        {
+            if (first < 0)
+            {
+                first = frame;
+                first_a = crc_a;
+                first_b = crc_b;
+            }
+            differing++;
+        }
+        frame++;
+    }
+
+    // whatever is left in the longer one
+    long extra_a = 0, extra_b = 0;
+    extra_a += more_a;
+    extra_b += more_b;
+    while (FrameLogRead(a, &crc_a))
+    {
+        extra_a++;
+    }
+    while (FrameLogRead(b, &crc_b))
+    {
+        extra_b++;
+    }
+    fclose(a);
+    fclose(b);
+
+    if (first >= 0)
+    {
+        printf("First difference at frame %ld (%08x against %08x), %ld of %ld frames differ\n", first,
+               (unsigned int)first_a, (unsigned int)first_b, differing, frame);
+    }
+    else
+    {
+        printf("Same %ld frames\n", frame);
+    }
+    if (extra_a || extra_b)
+    {
+        printf("%s has %ld more frames\n", extra_a ? argv[1] : argv[2], extra_a ? extra_a : extra_b);
+    }
+    return (first >= 0 || extra_a || extra_b) ? 1 : 0;
+}
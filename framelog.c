@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Frame hash log: a CRC32C of the video RAM at every VBlank, 4 bytes a frame,
+// so that two runs can be compared frame by frame (framecompare) without
+// keeping any video. A change to the core that changes what's on screen shows
+// up as the first frame where the logs differ.
+//
+// The file is FRAMELOG_MAGIC then the CRCs, little-endian, frame 0 first.
+// CRC32C is the one x86 has an instruction for (SSE4.2, 8 bytes at a time);
+// without it, it's a table lookup per byte, same results.
+//
+//   FrameLog log;
+//   FrameLogOpen(&log, "run.crc");
+//   FrameLogAdd(&log, state->memory + 0x2400);   // every frame
+//   FrameLogClose(&log);
+
+#define FRAMELOG_MAGIC "VRAMCRC1"
+#define FRAMELOG_MAGIC_SIZE 8
+
+typedef struct FrameLog
+{
+    FILE *fp;
+    long frames;
+} FrameLog;
+
+static uint32_t crc32c_table[256];
+
+static void Crc32cTable()
+{
+    uint32_t i, bit;
+
+    for (i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+        }
+        crc32c_table[i] = crc;
+    }
+}
+
+static uint32_t Crc32cBytes(uint32_t crc, const uint8_t *data, size_t length)
+{
+    if (crc32c_table[1] == 0)
+    {
+        Crc32cTable();
+    }
+    while (length--)
+    {
+        crc = (crc >> 8) ^ crc32c_table[(crc ^ *data++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t Crc32cHardware(uint32_t crc, const uint8_t *data, size_t length)
+{
+    uint64_t crc64 = crc;
+
+    for (; length >= 8; data += 8, length -= 8)
+    {
+        uint64_t word;
+
+        memcpy(&word, data, sizeof(word));
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for (; length; data++, length--)
+    {
+        crc = __builtin_ia32_crc32qi(crc, *data);
+    }
+    return crc;
+}
+#endif
+
+uint32_t Crc32c(const void *data, size_t length)
+{
+    uint32_t crc = ~0u;
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return ~Crc32cHardware(crc, (const uint8_t *)data, length);
+    }
+#endif
+    return ~Crc32cBytes(crc, (const uint8_t *)data, length);
+}
+
+// Returns FALSE if path can't be written
+int FrameLogOpen(FrameLog *log, const char *path)
+{
+    log->fp = fopen(path, "wb");
+    log->frames = 0;
+    if (log->fp == NULL)
+    {
+        return FALSE;
+    }
+    fwrite(FRAMELOG_MAGIC, FRAMELOG_MAGIC_SIZE, 1, log->fp);
+    return TRUE;
+}
+
+// The video RAM at the end of a frame
+void FrameLogAdd(FrameLog *log, const uint8_t *vram)
+{
+    uint32_t crc = Crc32c(vram, 0x1c00);
+    uint8_t bytes[4] = {crc & 0xff, (crc >> 8) & 0xff, (crc >> 16) & 0xff, crc >> 24};
+
+    fwrite(bytes, sizeof(bytes), 1, log->fp);
+    log->frames++;
+}
+
+void FrameLogClose(FrameLog *log)
+{
+    fclose(log->fp);
+}
+
+// Reads the next CRC of a log opened for reading and past its magic. Returns
+// FALSE at the end
+int FrameLogRead(FILE *fp, uint32_t *crc)
+{
+    uint8_t bytes[4];
+
+    if (fread(bytes, sizeof(bytes), 1, fp) != 1)
+    {
+        return FALSE;
+    }
+    *crc = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    return TRUE;
+}
+
+// Opens a log for FrameLogRead. NULL if it can't be read or isn't one
+FILE *FrameLogOpenRead(const char *path)
+{
+    char magic[FRAMELOG_MAGIC_SIZE];
+    FILE *fp = fopen(path, "rb");
+
+    if (fp && (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, FRAMELOG_MAGIC, sizeof(magic)) != 0))
+    {
+        fclose(fp);
+        fp = NULL;
+    }
+    return fp;
+}
@@ -0,0 +1,130 @@
+// Superinstructions: the sequences listed in fused_ops.h run as one dispatch.
+// Each handler is built from Execute8080 with constant opcodes, so the compiler
+// only keeps the cases it needs, the opcode definitions stay in one place.
+// A handler stops early if an instruction didn't fall through to the next one
+// (taken conditional jump) or the cycle count reached the deadline (the next
+// interrupt, 0 if nobody is counting), then the normal dispatch picks up from
+// there, same as the threaded and recompiled cores.
+
+typedef int (*FusedHandler)(State8080 *state, uint64_t deadline);
+
+typedef struct FusedSequence
+{
+    uint8_t length;
+    uint8_t ops[4];
+    FusedHandler handler;
+} FusedSequence;
+
+#define FUSED_OP(op)                                                       \
+    next_pc = state->pc + opcode_lengths[op];                              \
+    state->pc += Execute8080(state, op);                                   \
+    ran++;                                                                 \
+    if (state->pc != next_pc ||                                            \
+        (deadline && (int)(deadline - state->cycles) <= 0))                \
+    {                                                                      \
+        return ran;                                                        \
+    }
+
+// generate one handler per sequence
+#define FUSE2(a, b)                                                        \
+    int Fused_##a##_##b(State8080 *state, uint64_t deadline)           \
+    {                                                                      \
+        int ran = 0;                                                       \
+        uint16_t next_pc;                                                  \
+        FUSED_OP(a)                                                        \
+        FUSED_OP(b)                                                        \
+        return ran;                                                        \
+    }
+#define FUSE3(a, b, c)                                                     \
+    int Fused_##a##_##b##_##c(State8080 *state, uint64_t deadline)     \
+    {                                                                      \
+        int ran = 0;                                                       \
+        uint16_t next_pc;                                                  \
+        FUSED_OP(a)                                                        \
+        FUSED_OP(b)                                                        \
+        FUSED_OP(c)                                                        \
+        return ran;                                                        \
+    }
+#define FUSE4(a, b, c, d)                                                  \
+    int Fused_##a##_##b##_##c##_##d(State8080 *state, uint64_t deadline)\
+    {                                                                      \
+        int ran = 0;                                                       \
+        uint16_t next_pc;                                                  \
+        FUSED_OP(a)                                                        \
+        FUSED_OP(b)                                                        \
+        FUSED_OP(c)                                                        \
+        FUSED_OP(d)                                                        \
+        return ran;                                                        \
+    }
+#include "fused_ops.h"
+#undef FUSE2
+#undef FUSE3
+#undef FUSE4
+
+// and the table the dispatcher searches, in fused_ops.h order (longest first)
+#define FUSE2(a, b) {2, {a, b}, Fused_##a##_##b},
+#define FUSE3(a, b, c) {3, {a, b, c}, Fused_##a##_##b##_##c},
+#define FUSE4(a, b, c, d) {4, {a, b, c, d}, Fused_##a##_##b##_##c##_##d},
+FusedSequence fused_sequences[] = {
+#include "fused_ops.h"
+};
+#undef FUSE2
+#undef FUSE3
+#undef FUSE4
+
+#define FUSED_COUNT (int)(sizeof(fused_sequences) / sizeof(fused_sequences[0]))
+
+// fused_sequences[fused_start[op]] up to fused_end[op] are the ones starting with op
+// (16 bits, make profile can write more than 255 of them)
+uint16_t fused_start[256];
+uint16_t fused_end[256];
+
+void InitializeFused()
+{
+    int i;
+    for (i = FUSED_COUNT - 1; i >= 0; i--)
+    {
+        uint8_t op = fused_sequences[i].ops[0];
+        if (fused_end[op] == 0)
+        {
+            fused_end[op] = i + 1;
+        }
+        fused_start[op] = i;
+    }
+}
+
+// Runs the longest sequence matching the code at PC, InitializeFused must have been called.
+// Returns the number of instructions executed, 0 if nothing matched
+int RunFused(State8080 *state, uint64_t deadline)
+{
+    uint8_t *code = &state->memory[state->pc];
+    int i, j;
+
+    for (i = fused_start[*code]; i < fused_end[*code]; i++)
+    {
+        FusedSequence *sequence = &fused_sequences[i];
+
+        if (sequence->ops[0] != *code)
+        {
+            continue;
+        }
+
+        int offset = opcode_lengths[sequence->ops[0]];
+        for (j = 1; j < sequence->length; j++)
+        {
+            if (state->pc + offset >= ADDRESS_SPACE || code[offset] != sequence->ops[j])
+            {
+                break;
+            }
+            offset += opcode_lengths[sequence->ops[j]];
+        }
+
+        // the operands of the last one have to be in memory too
+        if (j == sequence->length && state->pc + offset <= ADDRESS_SPACE)
+        {
+            return sequence->handler(state, deadline);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,34 @@
+// generated by the PROFILE_OPCODES build of headless.c, do not edit
+// FUSEn(opcodes...) // times seen, dispatches saved
+FUSE4(0xd3, 0x3a, 0xa7, 0xca) // 390452, 1171356
+FUSE4(0x7e, 0xa7, 0xc2, 0x23) // 307103, 921309
+FUSE4(0xa7, 0xc2, 0x23, 0x05) // 300217, 900651
+FUSE4(0xc2, 0x23, 0x05, 0xc2) // 300116, 900348
+FUSE4(0x01, 0x09, 0xc1, 0x05) // 34820, 104460
+FUSE4(0x09, 0xc1, 0x05, 0xc2) // 34819, 104457
+FUSE4(0x23, 0x7d, 0xe6, 0xfe) // 29102, 87306
+FUSE4(0x7d, 0xe6, 0xfe, 0xda) // 29089, 87267
+FUSE4(0x36, 0x23, 0x7d, 0xe6) // 29079, 87237
+FUSE3(0x3a, 0x3d, 0xc2) // 1738962, 3477924
+FUSE3(0x3a, 0xa7, 0xc2) // 1649240, 3298480
+FUSE3(0x3a, 0xa7, 0xca) // 401655, 803310
+FUSE3(0xd3, 0x3a, 0xa7) // 390643, 781286
+FUSE3(0x7e, 0xa7, 0xc2) // 309556, 619112
+FUSE3(0xa7, 0xc2, 0x23) // 307294, 614588
+FUSE3(0xc2, 0x23, 0x05) // 300390, 600780
+FUSE3(0x23, 0x05, 0xc2) // 300372, 600744
+FUSE3(0x3a, 0xfe, 0xc9) // 75696, 151392
+FUSE3(0xd3, 0xdb, 0x77) // 37344, 74688
+FUSE3(0x01, 0x09, 0xc1) // 34821, 69642
+FUSE2(0x3a, 0xa7) // 2070748, 2070748
+FUSE2(0xa7, 0xc2) // 1959673, 1959673
+FUSE2(0x3a, 0x3d) // 1740121, 1740121
+FUSE2(0x3d, 0xc2) // 1739479, 1739479
+FUSE2(0xa7, 0xca) // 402423, 402423
+FUSE2(0xd3, 0x3a) // 390757, 390757
+FUSE2(0x05, 0xc2) // 349363, 349363
+FUSE2(0xc2, 0x23) // 316115, 316115
+FUSE2(0x7e, 0xa7) // 312783, 312783
+FUSE2(0x23, 0x05) // 300646, 300646
+FUSE2(0x3a, 0xfe) // 113816, 113816
+FUSE2(0xfe, 0xc9) // 75716, 75716
@@ -0,0 +1,1177 @@
+#define _GNU_SOURCE // for fork.c, has to come before any system header
+#include "machine.c"
+#include "fork.c"
+#include "observe.c"
+#include "env.c"
+#include "pacer.c"
+#include "savestate.c"
+#include "runahead.c"
+#include "video.c"
+#include "scale.c"
+#include "phosphor.c"
+#include "recorder.c"
+#include "framelog.c"
+#include "wav.c"
+#include <string.h>
+#include <time.h>
+
+// Runs the machine without a screen, as fast as the host allows.
+// Used for profiling and benchmarking the core on the real game.
+//
+//   headless [-frames N] [-profile N] [-hle verify|fast] [-forks N] [-hash]
+//            [-envs N] [-threads N] [-observe WxH] [-export name] [-realtime]
+//            [-runahead N] [-dirty] [-overlay file] [-scale] [-phosphor]
+//            [-record file.y4m] [-framelog file] [-wav file] [-rate N] [rom]
+//
+// -forks N runs the game for the given frames, then forks it N times
+// copy-on-write (fork.c) and runs each fork for one frame.
+// -hash looks for repeated states between frames with MachineStateHash.
+// -export name publishes every frame of the plain run in shared memory
+// (export.c), for exportreader or any other process, and removes it at the end.
+// -realtime holds the run to the speed of the real machine with pacer.c.
+// -runahead N starts a game and measures how many frames it takes for a move
+// or a shot to show on screen with run-ahead (runahead.c) from 0 to N frames, and what
+// each costs.
+// -dirty runs the given frames of attract mode, then as many of a game with
+// random inputs, converting only the dirty columns of the screen (video.c),
+// checks them against converting everything, and reports how much it saves.
+// -overlay file times converting whole frames with the color overlay in file
+// (overlay.c) against black and white.
+// -scale times each scaler (scale.c) on the given frames, and checks that
+// scaling only the dirty columns gives the same frames as scaling all of them.
+// -phosphor times phosphor.c at 1x, 2x and 3x.
+// -record file.y4m writes the frames of the run as video (recorder.c), in the
+// colors of -overlay file if there's one (which doesn't time the overlay then).
+// Every frame makes it, the run waits for the writer, except with -realtime
+// where a frame the writer has no room for is dropped and counted.
+// -framelog file writes a CRC32C of the screen every frame (framelog.c), for
+// framecompare to find the first frame where two runs differ.
+// -wav file plays the given frames of attract mode and as many of a game with
+// random inputs, writing the sound (sound.c) to file at -rate samples per
+// second (48000), then checks that the real-time path (run-ahead, the ring,
+// the audio callback) gives the same samples.
+// -envs N steps N environments (env.c) with random actions, on -threads
+// threads, for the given frames (4 frames per step). With -observe, the
+// environments give stacks of 4 WxH grayscale images (observe.c), and without
+// -envs it times observe.c against drawing the RGBA frame first.
+
+void HeadlessUsage()
+{
+    printf("usage: headless [-frames N] [-profile N] [-hle verify|fast] [-forks N] [-hash]\n"
+           "                [-envs N] [-threads N] [-observe WxH] [-export name] [-realtime]\n"
+           "                [-runahead N] [-dirty] [-overlay file] [-scale] [-phosphor]\n"
+           "                [-record file.y4m] [-framelog file] [-wav file] [-rate N] [rom]\n");
+}
+
+// a copy of a machine, with its own memory and device
+void CopyMachine(State8080 *to, uint8_t *memory, MachineDevice *device, State8080 *from)
+{
+    *to = *from;
+    to->memory = memory;
+    memcpy(memory, from->memory, ADDRESS_SPACE);
+    *device = *MachineDeviceOf(from);
+    device->sound = NULL;
+    MachineConnect(to, device);
+}
+
+// Runs frames, looking up the state hash after each one in a table of the
+// previous ones: the first repeat means the game is going round in a loop
+void RunHashed(State8080 *state, int frames)
+{
+    int size = 1;
+    while (size < 2 * frames)
+    {
+        size *= 2;
+    }
+
+    uint64_t *seen = (uint64_t *)calloc(size, sizeof(uint64_t));
+    int *seen_frame = (int *)calloc(size, sizeof(int));
+    int repeats = 0;
+    int frame;
+
+    for (frame = 0; frame < frames; frame++)
+    {
+        MachineRunFrame(state);
+
+        uint64_t hash = MachineStateHash(state);
+        int slot = hash & (size - 1);
+
+        while (seen[slot] && seen[slot] != hash)
+        {
+            slot = (slot + 1) & (size - 1);
+        }
+
+        if (seen[slot])
+        {
+            if (repeats == 0)
+            {
+                printf("Frame %d repeats the state of frame %d (loop of %d frames)\n", frame, seen_frame[slot],
+                       frame - seen_frame[slot]);
+            }
+            repeats++;
+        }
+        else
+        {
+            seen[slot] = hash;
+            seen_frame[slot] = frame;
+        }
+    }
+
+    uint64_t incremental = state->memory_hash;
+    HashMemory(state);
+
+    printf("Frames: %d, %d of them repeat an earlier state\n", frames, repeats);
+    printf("State hash: %016llx, memory hash %s the one computed from scratch\n",
+           (unsigned long long)MachineStateHash(state), (incremental == state->memory_hash) ? "matches" : "DOES NOT match");
+
+    free(seen);
+    free(seen_frame);
+}
+
+// private dirty memory of the process in KB (Linux only, -1 elsewhere)
+long PrivateDirtyKB()
+{
+    FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+    char line[256];
+    long kb = -1;
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "Private_Dirty: %ld kB", &kb) == 1)
+        {
+            break;
+        }
+    }
+    fclose(fp);
+    return kb;
+}
+
+double Seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// CPU time of the calling thread only
+double ThreadSeconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void RunForks(State8080 *state, int forks, int frames)
+{
+    MachineSnapshot snapshot;
+    MachineFork *fork = (MachineFork *)malloc(forks * sizeof(MachineFork));
+    int i, frame;
+
+    for (frame = 0; frame < frames; frame++)
+    {
+        MachineRunFrame(state);
+    }
+
+    if (fork == NULL || !ForkSnapshot(&snapshot, state))
+    {
+        printf("error: Unable to set up the snapshot\n");
+        exit(1);
+    }
+
+    long dirty_before = PrivateDirtyKB();
+    double start = Seconds();
+
+    for (i = 0; i < forks; i++)
+    {
+        if (!ForkMachine(&fork[i], &snapshot))
+        {
+            printf("error: Unable to map fork %d\n", i);
+            exit(1);
+        }
+    }
+
+    double fork_seconds = Seconds() - start;
+
+    start = Seconds();
+    for (i = 0; i < forks; i++)
+    {
+        ForkRunFrames(&fork[i], 1);
+    }
+    double run_seconds = Seconds() - start;
+
+    long dirty_after = PrivateDirtyKB();
+
+    // the same frame from a plain copy of the machine
+    State8080 copy;
+    MachineDevice copy_device;
+    uint8_t *copy_memory = (uint8_t *)malloc(ADDRESS_SPACE);
+    start = Seconds();
+    CopyMachine(&copy, copy_memory, &copy_device, state);
+    double copy_seconds = Seconds() - start;
+    MachineRunFrame(&copy);
+
+    int matching = 0;
+    for (i = 0; i < forks; i++)
+    {
+        if (fork[i].state.pc == copy.pc && fork[i].state.sp == copy.sp && fork[i].state.a == copy.a &&
+            fork[i].state.cycles == copy.cycles && memcmp(fork[i].state.memory, copy.memory, ADDRESS_SPACE) == 0)
+        {
+            matching++;
+        }
+    }
+
+    printf("Forks: %d, from frame %d, one frame each\n", forks, frames);
+    printf("Fork: %.2f us each (plain copy of the memory: %.2f us)\n", fork_seconds / forks * 1e6, copy_seconds * 1e6);
+    printf("Running: %.2f us per fork and frame\n", run_seconds / forks * 1e6);
+    if (dirty_before >= 0)
+    {
+        printf("Memory: %.1f KB per fork after its frame (a copy is %d KB)\n",
+               (double)(dirty_after - dirty_before) / forks, ADDRESS_SPACE / 1024);
+    }
+    printf("Forks matching a plain copy: %d of %d\n", matching, forks);
+
+    for (i = 0; i < forks; i++)
+    {
+        ForkRelease(&fork[i]);
+    }
+    ForkSnapshotRelease(&snapshot);
+    free(fork);
+    free(copy_memory);
+}
+
+// The long way for an observation: the whole frame in RGBA like the SDL
+// frontend would draw it, max of the two frames, grayscale, then box averages
+void ObserveThroughRgba(Observe *observe, uint8_t *vram, uint8_t *previous, uint32_t *rgba, uint8_t *out)
+{
+    int x, y, i, row;
+
+    for (x = 0; x < OBSERVE_COLUMNS; x++)
+    {
+        for (y = 0; y < OBSERVE_ROWS; y++)
+        {
+            int lit = (vram[x * 32 + (y >> 3)] >> (y & 7)) & 1;
+            int previous_lit = (previous[x * 32 + (y >> 3)] >> (y & 7)) & 1;
+            uint32_t pixel = lit ? 0xffffffff : 0xff000000;
+            uint32_t previous_pixel = previous_lit ? 0xffffffff : 0xff000000;
+            int channel;
+
+            // per channel max of the two frames
+            uint32_t pooled = 0;
+            for (channel = 0; channel < 32; channel += 8)
+            {
+                uint32_t a = (pixel >> channel) & 0xff, b = (previous_pixel >> channel) & 0xff;
+                pooled |= (a > b ? a : b) << channel;
+            }
+            rgba[(255 - y) * OBSERVE_COLUMNS + x] = pooled;
+        }
+    }
+
+    for (row = 0; row < observe->height; row++)
+    {
+        int top = row * OBSERVE_ROWS / observe->height;
+        int bottom = (row + 1) * OBSERVE_ROWS / observe->height;
+
+        for (i = 0; i < observe->width; i++)
+        {
+            int first = observe->column_first[i];
+            int area = observe->column_pixels[i] * (bottom - top);
+            int sum = 0;
+
+            for (y = top; y < bottom; y++)
+            {
+                for (x = first; x < first + observe->column_pixels[i]; x++)
+                {
+                    uint32_t pixel = rgba[y * OBSERVE_COLUMNS + x];
+                    sum += (((pixel >> 16) & 0xff) * 299 + ((pixel >> 8) & 0xff) * 587 + (pixel & 0xff) * 114) / 1000;
+                }
+            }
+            out[row * observe->width + i] = (sum + area / 2) / area;
+        }
+    }
+}
+
+void RunObserve(State8080 *state, int width, int height, int frames)
+{
+    static Observe observe;
+    static uint8_t previous[ENV_OBSERVATION_SIZE];
+    static uint32_t rgba[OBSERVE_COLUMNS * OBSERVE_ROWS];
+    static uint8_t fast[OBSERVE_COLUMNS * OBSERVE_ROWS];
+    static uint8_t slow[OBSERVE_COLUMNS * OBSERVE_ROWS];
+    double fast_seconds = 0, slow_seconds = 0;
+    int frame, differing = 0;
+
+    if (!ObserveInit(&observe, width, height))
+    {
+        printf("error: -observe goes up to 224x256, with at least 5 rows\n");
+        exit(1);
+    }
+
+    for (frame = 0; frame < frames; frame++)
+    {
+        memcpy(previous, state->memory + ENV_VIDEO_RAM, ENV_OBSERVATION_SIZE);
+        MachineRunFrame(state);
+
+        double start = Seconds();
+        ObserveGray(&observe, state->memory + ENV_VIDEO_RAM, previous, fast);
+        fast_seconds += Seconds() - start;
+
+        start = Seconds();
+        ObserveThroughRgba(&observe, state->memory + ENV_VIDEO_RAM, previous, rgba, slow);
+        slow_seconds += Seconds() - start;
+
+        differing += memcmp(fast, slow, width * height) != 0;
+    }
+
+    printf("Observations: %d of %dx%d, max-pooled over 2 frames\n", frames, width, height);
+    printf("From video RAM: %.2f us each\n", fast_seconds / frames * 1e6);
+    printf("Through RGBA:   %.2f us each\n", slow_seconds / frames * 1e6);
+    printf("Frames where the two differ: %d\n", differing);
+}
+
+void RunEnvs(uint8_t *rom, int rom_size, int count, int threads, int frames, int width, int height)
+{
+    EnvPool pool;
+    int steps = frames / 4;
+    int i, step;
+
+    // big enough for either kind of observation
+    uint8_t *observations = (uint8_t *)malloc((size_t)count * 4 * OBSERVE_COLUMNS * OBSERVE_ROWS);
+    uint8_t *actions = (uint8_t *)malloc(count);
+    int *rewards = (int *)malloc(count * sizeof(int));
+    uint8_t *dones = (uint8_t *)malloc(count);
+
+    if (!observations || !actions || !rewards || !dones ||
+        !EnvPoolInit(&pool, rom, rom_size, count, threads, 4, 1) ||
+        (width && !EnvPoolObserve(&pool, width, height, 4, FALSE)))
+    {
+        printf("error: Unable to set up the environments\n");
+        exit(1);
+    }
+
+    EnvReset(&pool, observations);
+
+    long long total_reward = 0;
+    long episodes = 0;
+    double start = Seconds();
+
+    for (step = 0; step < steps; step++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            actions[i] = rand() % ENV_ACTIONS;
+        }
+
+        EnvStep(&pool, actions, observations, rewards, dones);
+
+        for (i = 0; i < count; i++)
+        {
+            total_reward += rewards[i];
+            episodes += dones[i];
+        }
+    }
+
+    double seconds = Seconds() - start;
+
+    printf("Environments: %d on %d threads, %d steps of 4 frames\n", count, pool.threads, steps);
+    printf("Steps: %.0f per second (%.0f frames per second)\n", (double)count * steps / seconds, (double)count * steps * 4 / seconds);
+    printf("Episodes finished: %ld, points scored: %lld\n", episodes, total_reward);
+
+    EnvPoolRelease(&pool);
+    free(observations);
+    free(actions);
+    free(rewards);
+    free(dones);
+}
+
+// frames shown after a move until it's on screen, the first one counting as 1
+#define LATENCY_FRAMES 12
+
+// Shows frames with ahead->frames of run-ahead from the saved point, holding
+// input on port 1, and keeps what was shown
+void RunAheadShow(RunAhead *ahead, State8080 *state, SaveState *from, uint8_t input,
+                  uint8_t shown[LATENCY_FRAMES][0x1c00])
+{
+    int frame;
+
+    LoadMachine(from, state);
+    MachineDeviceOf(state)->r_port[1] = input;
+    for (frame = 0; frame < LATENCY_FRAMES; frame++)
+    {
+        memcpy(shown[frame], RunAheadFrame(ahead, state), 0x1c00);
+    }
+    MachineDeviceOf(state)->r_port[1] = 0;
+}
+
+void RunRunAhead(State8080 *state, int most)
+{
+    static SaveState from;
+    static RunAhead ahead;
+    static uint8_t still[LATENCY_FRAMES][0x1c00], moved[LATENCY_FRAMES][0x1c00];
+    int frame, n, trial;
+    const int trials = 21;
+
+    // right, left, fire
+    uint8_t inputs[3] = {0x40, 0x20, 0x10};
+
+    // coin, 1P start, on until the ship is there, and the ship off the left
+    // edge where it starts
+    for (frame = 0; frame < 760; frame++)
+    {
+        MachineDeviceOf(state)->r_port[1] = (frame >= 100 && frame < 105) ? 0x01 : (frame >= 200 && frame < 205) ? 0x04 : (frame >= 700) ? 0x40 : 0x00;
+        MachineRunFrame(state);
+    }
+    MachineDeviceOf(state)->r_port[1] = 0;
+    if (state->memory[ENV_GAME_MODE] != 1)
+    {
+        printf("error: The game didn't start\n");
+        return;
+    }
+    SaveMachine(&from, state);
+
+    double start = Seconds();
+    for (frame = 0; frame < 1000; frame++)
+    {
+        SaveMachine(&ahead.save, state);
+        LoadMachine(&ahead.save, state);
+    }
+    printf("Save and load: %.2f us\n", (Seconds() - start) / 1000 * 1e6);
+
+    printf("Run-ahead  frames to show a move  input to photon  per frame shown\n");
+    for (n = 0; n <= most && n <= RUNAHEAD_MAX_FRAMES; n++)
+    {
+        int total = 0, measured = 0;
+
+        ahead.frames = n;
+        for (trial = 0; trial < trials; trial++)
+        {
+            // from a few frames apart, left and right in turn, against not moving
+            static SaveState point;
+
+            LoadMachine(&from, state);
+            for (frame = 0; frame < trial * 3; frame++)
+            {
+                MachineRunFrame(state);
+            }
+            SaveMachine(&point, state);
+
+            RunAheadShow(&ahead, state, &point, 0x00, still);
+            RunAheadShow(&ahead, state, &point, inputs[trial % 3], moved);
+
+            for (frame = 0; frame < LATENCY_FRAMES; frame++)
+            {
+                if (memcmp(still[frame], moved[frame], 0x1c00) != 0)
+                {
+                    total += frame + 1;
+                    measured++;
+                    break;
+                }
+            }
+        }
+
+        // what it costs: the same frames with and without run-ahead
+        LoadMachine(&from, state);
+        start = Seconds();
+        for (frame = 0; frame < 600; frame++)
+        {
+            RunAheadFrame(&ahead, state);
+        }
+        double seconds = (Seconds() - start) / 600;
+
+        // a move is pressed half a frame before the next one starts on average,
+        // and shows when the frame it's on ends
+        double frames = measured ? (double)total / measured : 0;
+        printf("%9d  %12.2f (%2d of %2d)  %11.1f ms  %11.1f us\n", n, frames, measured, trials,
+               (frames + 0.5) * 1000 / FRAMES_PER_SECOND, seconds * 1e6);
+    }
+}
+
+// Attract mode then a game, with and without run-ahead, converting only the
+// dirty columns into pixels and checking them against all of them every frame
+// Port 1 for frame: attract mode for the first frames, then coin and 1P start,
+// then a random move every 8 frames, fire held half the time
+void DemoInput(State8080 *state, int frame, int frames, uint32_t *random)
+{
+    uint8_t *input = &MachineDeviceOf(state)->r_port[1];
+    int played = frame - frames;
+
+    *random ^= *random << 13;
+    *random ^= *random >> 17;
+    *random ^= *random << 5;
+    if (played < 0)
+    {
+        *input = 0;
+    }
+    else if (played < 200)
+    {
+        *input = (played < 5) ? 0x01 : (played >= 100 && played < 105) ? 0x04 : 0x00;
+    }
+    else if ((frame & 7) == 0)
+    {
+        *input = (*random & 0x70) & ~((*random & 0x60) == 0x60 ? 0x20 : 0);
+    }
+}
+
+void RunDirty(State8080 *reset, int frames)
+{
+    static SaveState start;
+    static RunAhead ahead;
+    static uint32_t pixels[VIDEO_WIDTH * VIDEO_HEIGHT], all[VIDEO_WIDTH * VIDEO_HEIGHT];
+    static Overlay overlay;
+    uint32_t dirty[VIDEO_DIRTY_WORDS];
+    uint32_t random = 2463534242u;
+    int frame;
+
+    OverlayLoad(&overlay, "assets/overlay.txt");
+    SaveMachine(&start, reset);
+    for (ahead.frames = 0; ahead.frames <= 2; ahead.frames += 2)
+    {
+        DirtyStats stats = {0};
+        double dirty_seconds = 0, all_seconds = 0;
+        int wrong = 0;
+
+        LoadMachine(&start, reset);
+        reset->write_hook = VideoWriteHook;
+        VideoDirtyAll();
+
+        for (frame = 0; frame < 2 * frames; frame++)
+        {
+            DemoInput(reset, frame, frames, &random);
+
+            const uint8_t *vram = RunAheadFrame(&ahead, reset);
+
+            double begin = Seconds();
+            VideoTakeDirty(dirty);
+            VideoDrawDirty(vram, pixels, &overlay, dirty);
+            dirty_seconds += Seconds() - begin;
+
+            begin = Seconds();
+            VideoDraw(vram, all, &overlay);
+            all_seconds += Seconds() - begin;
+
+            DirtyStatsAdd(&stats, dirty, reset->memory[ENV_GAME_MODE]);
+            wrong += memcmp(pixels, all, sizeof(pixels)) != 0;
+        }
+        reset->write_hook = NULL;
+        MachineDeviceOf(reset)->r_port[1] = 0;
+
+        printf("Run-ahead %d: %d frames of attract mode, then %d more with a game going\n", ahead.frames, frames, frames);
+        DirtyStatsPrint(&stats);
+        printf("Converting: %.1f us per frame for the dirty columns, %.1f us for all of them\n",
+               dirty_seconds / (2 * frames) * 1e6, all_seconds / (2 * frames) * 1e6);
+        printf("Frames where the dirty columns missed something: %d\n", wrong);
+    }
+}
+
+// Whole frames into pixels, black and white and with the overlay, one after
+// the other on the same frames
+void RunOverlay(State8080 *state, const char *path, int frames)
+{
+    static Overlay monochrome, overlay;
+    static uint32_t pixels[VIDEO_WIDTH * VIDEO_HEIGHT];
+    double seconds[2] = {0, 0};
+    long long colored = 0;
+    int frame, i, pass;
+
+    OverlayMonochrome(&monochrome);
+    if (!OverlayLoad(&overlay, path))
+    {
+        printf("error: Couldn't load the overlay %s\n", path);
+        exit(1);
+    }
+
+    for (frame = 0; frame < frames; frame++)
+    {
+        MachineRunFrame(state);
+        for (pass = 0; pass < 2; pass++)
+        {
+            double start = Seconds();
+            VideoDraw(state->memory + 0x2400, pixels, pass ? &overlay : &monochrome);
+            seconds[pass] += Seconds() - start;
+        }
+        for (i = 0; i < VIDEO_WIDTH * VIDEO_HEIGHT; i++)
+        {
+            colored += (pixels[i] != 0xff000000 && pixels[i] != 0xffffffff);
+        }
+    }
+
+    printf("Overlay %s: %d row tables for %d columns\n", path, overlay.tables, VIDEO_WIDTH);
+    printf("Converting: %.1f us per frame black and white, %.1f us with the overlay\n", seconds[0] / frames * 1e6,
+           seconds[1] / frames * 1e6);
+    printf("Colored pixels: %.0f per frame\n", (double)colored / frames);
+}
+
+// Every scaler on the same frames: all of it each frame, timed, and only the
+// dirty columns into another buffer, compared
+void RunScale(State8080 *reset, int frames)
+{
+    static SaveState start;
+    static Overlay overlay;
+    static uint32_t pixels[VIDEO_WIDTH * VIDEO_HEIGHT];
+    static uint32_t scaled[9 * VIDEO_WIDTH * VIDEO_HEIGHT], incremental[9 * VIDEO_WIDTH * VIDEO_HEIGHT];
+    uint32_t dirty[VIDEO_DIRTY_WORDS];
+    int i, frame;
+
+    OverlayLoad(&overlay, "assets/overlay.txt");
+    SaveMachine(&start, reset);
+
+    for (i = 0; i < SCALERS; i++)
+    {
+        const Scaler *scaler = &scalers[i];
+        int size = scaler->factor * scaler->factor * VIDEO_WIDTH * VIDEO_HEIGHT;
+        double seconds = 0;
+        int wrong = 0;
+
+        LoadMachine(&start, reset);
+        reset->write_hook = VideoWriteHook;
+        VideoDirtyAll();
+
+        for (frame = 0; frame < frames; frame++)
+        {
+            int x = 0, width;
+
+            MachineRunFrame(reset);
+            VideoTakeDirty(dirty);
+            VideoDrawDirty(reset->memory + 0x2400, pixels, &overlay, dirty);
+
+            double begin = Seconds();
+            scaler->run(pixels, scaled, 0, VIDEO_WIDTH);
+            seconds += Seconds() - begin;
+
+            while ((width = VideoDirtyRun(dirty, &x)) > 0)
+            {
+                int first = x, last = x + width;
+
+                ScaleWiden(&first, &last);
+                scaler->run(pixels, incremental, first, last);
+                x += width;
+            }
+            wrong += memcmp(scaled, incremental, size * sizeof(uint32_t)) != 0;
+        }
+        reset->write_hook = NULL;
+
+        printf("%-8s  %dx%d  %7.1f us per frame  %7.1f MP/s  dirty columns only: %s\n", scaler->name,
+               scaler->factor * VIDEO_WIDTH, scaler->factor * VIDEO_HEIGHT, seconds / frames * 1e6,
+               (double)size * frames / seconds / 1e6, wrong ? "DIFFERENT" : "same");
+    }
+}
+
+// The phosphor at 1x and after the 2x and 3x scalers, timed, and checked
+// against doing it a channel at a time
+void RunPhosphor(State8080 *reset, int frames)
+{
+    static SaveState start;
+    static Overlay overlay;
+    static uint32_t pixels[VIDEO_WIDTH * VIDEO_HEIGHT];
+    static uint32_t scaled[9 * VIDEO_WIDTH * VIDEO_HEIGHT], check[9 * VIDEO_WIDTH * VIDEO_HEIGHT];
+    const Scaler *sizes[] = {NULL, ScalerFind("nearest2"), ScalerFind("nearest3")};
+    int i, frame, p;
+
+    OverlayLoad(&overlay, "assets/overlay.txt");
+    SaveMachine(&start, reset);
+
+    for (i = 0; i < 3; i++)
+    {
+        const Scaler *scaler = sizes[i];
+        int factor = scaler ? scaler->factor : 1;
+        int size = factor * factor * VIDEO_WIDTH * VIDEO_HEIGHT;
+        const uint32_t *frame_pixels = scaler ? scaled : pixels;
+        Phosphor phosphor;
+        double seconds = 0;
+        long fading = 0;
+        int wrong = 0;
+
+        PhosphorInit(&phosphor, size, 0.5);
+        memset(check, 0, sizeof(check));
+        LoadMachine(&start, reset);
+
+        for (frame = 0; frame < frames; frame++)
+        {
+            MachineRunFrame(reset);
+            VideoDraw(reset->memory + 0x2400, pixels, &overlay);
+            if (scaler)
+            {
+                scaler->run(pixels, scaled, 0, VIDEO_WIDTH);
+            }
+            // attract mode hardly flickers, so every other frame goes black
+            // like a shot between its frames: each lit pixel then fades too
+            if (frame & 1)
+            {
+                uint32_t *out = scaler ? scaled : pixels;
+
+                for (p = 0; p < size; p++)
+                {
+                    out[p] = 0xff000000;
+                }
+            }
+
+            double begin = Seconds();
+            const uint32_t *glow = PhosphorApply(&phosphor, frame_pixels);
+            seconds += Seconds() - begin;
+
+            for (p = 0; p < size * 4; p++)
+            {
+                uint8_t *old = (uint8_t *)check + p;
+                int sum = (*old * phosphor.decay >> 8) + ((const uint8_t *)frame_pixels)[p];
+
+                *old = sum > 255 ? 255 : sum;
+            }
+            wrong += memcmp(glow, check, size * sizeof(uint32_t)) != 0;
+            for (p = 0; p < size; p++)
+            {
+                fading += glow[p] != frame_pixels[p];
+            }
+        }
+        PhosphorRelease(&phosphor);
+
+        printf("%dx%d  %6.1f us per frame  %.3f ns per pixel  fading: %.1f%% of the pixels  %s\n",
+               factor * VIDEO_WIDTH, factor * VIDEO_HEIGHT, seconds / frames * 1e6, seconds / frames / size * 1e9,
+               100.0 * fading / ((double)size * frames), wrong ? "DIFFERENT" : "same as a channel at a time");
+    }
+}
+
+// The sound of a scripted game to a WAV file as fast as it runs, then the
+// same game through what SpaceInvaders does, compared sample for sample
+void RunWav(State8080 *reset, const char *path, int rate, int frames)
+{
+    static SaveState start;
+    static Sound sound;
+    static RunAhead ahead;
+    SoundRing ring;
+    Wav wav;
+    const int16_t *samples;
+    uint32_t random = 2463534242u;
+    long count = 0, played = 0, wrong = -1, i;
+    int frame, n;
+
+    if (!WavOpen(&wav, path, rate))
+    {
+        printf("error: Couldn't write %s\n", path);
+        return;
+    }
+    SaveMachine(&start, reset);
+    SoundInit(&sound, rate, reset->cycles);
+    MachineDeviceOf(reset)->sound = &sound;
+
+    int16_t *offline = (int16_t *)malloc(((size_t)2 * frames * rate / 59 + 1) * sizeof(int16_t));
+    double begin = Seconds(), sound_seconds = 0;
+    for (frame = 0; frame < 2 * frames; frame++)
+    {
+        DemoInput(reset, frame, frames, &random);
+        MachineRunFrame(reset);
+
+        double take = ThreadSeconds();
+        n = SoundTake(&sound, reset->cycles, &samples);
+        sound_seconds += ThreadSeconds() - take;
+        WavWrite(&wav, samples, n);
+        memcpy(offline + count, samples, n * sizeof(int16_t));
+        count += n;
+    }
+    double seconds = Seconds() - begin;
+    WavClose(&wav);
+    printf("%ld samples (%.1f s) to %s in %.3f s, %.0fx real time, %.2f us per frame making the samples\n", count,
+           (double)count / rate, path, seconds, (double)count / rate / seconds, sound_seconds * 1e6 / (2 * frames));
+
+    // again like SpaceInvaders: run-ahead, the frame's samples into the
+    // ring, and the callback taking 1024 at a time as the device would
+    LoadMachine(&start, reset);
+    SoundInit(&sound, rate, reset->cycles);
+    SoundRingInit(&ring, rate / 10);
+    ahead.frames = 2;
+    random = 2463534242u;
+    for (frame = 0; frame < 2 * frames; frame++)
+    {
+        int16_t callback[1024];
+
+        DemoInput(reset, frame, frames, &random);
+        RunAheadFrame(&ahead, reset);
+        n = SoundTake(&sound, reset->cycles, &samples);
+        SoundRingPush(&ring, samples, n);
+        while (atomic_load(&ring.head) - atomic_load(&ring.tail) >= 1024)
+        {
+            SoundRingPop(&ring, callback, 1024);
+            for (i = 0; i < 1024; i++, played++)
+            {
+                if (wrong < 0 && (played >= count || callback[i] != offline[played]))
+                {
+                    wrong = played;
+                }
+            }
+        }
+    }
+    MachineDeviceOf(reset)->sound = NULL;
+    SoundRingRelease(&ring);
+    free(offline);
+
+    if (wrong < 0)
+    {
+        printf("Real-time path: the same %ld samples\n", played);
+    }
+    else
+    {
+        printf("Real-time path: DIFFERENT from sample %ld\n", wrong);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *rom_path = "invaders.rom";
+    int frames = 3600;
+#if PROFILE_OPCODES
+    int fused_top = 32;
+#endif
+    int forks = 0;
+    int hashed = FALSE;
+    int envs = 0;
+    int realtime = FALSE;
+    int run_ahead = -1;
+    int dirty = FALSE;
+    int scale = FALSE;
+    int phosphor = FALSE;
+    const char *record_path = NULL;
+    const char *export_name = NULL;
+    const char *framelog_path = NULL;
+    const char *wav_path = NULL;
+    int rate = SOUND_RATE;
+    const char *overlay_path = NULL;
+    int threads = 1;
+    int observe_width = 0, observe_height = 0;
+
+    int arg;
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "-frames") == 0 && arg + 1 < argc)
+        {
+            frames = atoi(argv[++arg]);
+        }
+#if PROFILE_OPCODES
+        else if (strcmp(argv[arg], "-profile") == 0 && arg + 1 < argc)
+        {
+            fused_top = atoi(argv[++arg]);
+        }
+#endif
+        else if (strcmp(argv[arg], "-realtime") == 0)
+        {
+            realtime = TRUE;
+        }
+        else if (strcmp(argv[arg], "-runahead") == 0 && arg + 1 < argc)
+        {
+            run_ahead = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "-overlay") == 0 && arg + 1 < argc)
+        {
+            overlay_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "-scale") == 0)
+        {
+            scale = TRUE;
+        }
+        else if (strcmp(argv[arg], "-record") == 0 && arg + 1 < argc)
+        {
+            record_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "-wav") == 0 && arg + 1 < argc)
+        {
+            wav_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "-rate") == 0 && arg + 1 < argc)
+        {
+            rate = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "-framelog") == 0 && arg + 1 < argc)
+        {
+            framelog_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "-phosphor") == 0)
+        {
+            phosphor = TRUE;
+        }
+        else if (strcmp(argv[arg], "-dirty") == 0)
+        {
+            dirty = TRUE;
+        }
+        else if (strcmp(argv[arg], "-hash") == 0)
+        {
+            hashed = TRUE;
+        }
+        else if (strcmp(argv[arg], "-forks") == 0 && arg + 1 < argc)
+        {
+            forks = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "-envs") == 0 && arg + 1 < argc)
+        {
+            envs = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "-threads") == 0 && arg + 1 < argc)
+        {
+            threads = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "-export") == 0 && arg + 1 < argc)
+        {
+            export_name = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "-observe") == 0 && arg + 1 < argc)
+        {
+            sscanf(argv[++arg], "%dx%d", &observe_width, &observe_height);
+        }
+#if HLE_ROUTINES
+        else if (strcmp(argv[arg], "-hle") == 0 && arg + 1 < argc)
+        {
+            arg++;
+            if (strcmp(argv[arg], "verify") == 0)
+            {
+                hle_mode = HLE_VERIFY;
+            }
+            else if (strcmp(argv[arg], "fast") == 0)
+            {
+                hle_mode = HLE_FAST;
+            }
+            else
+            {
+                printf("error: -hle takes verify or fast, not %s\n", argv[arg]);
+                HeadlessUsage();
+                exit(1);
+            }
+#if RECOMPILED || THREADED_CORE
+            // the hooks are in MachineStep, which these cores only fall back
+            // to for code they don't cover, never at a routine's entry
+            printf("error: -hle only works with the interpreter, not the recompiled or threaded build\n");
+            exit(1);
+#endif
+        }
+#endif
+        else
+        {
+            rom_path = argv[arg];
+        }
+    }
+
+    State8080 *state = (State8080 *)malloc(sizeof(State8080));
+    static MachineDevice device; // the board, nothing pressed
+
+    if (!state)
+    {
+        printf("error: Unable to allocate memory for state.\n");
+        exit(1);
+    }
+
+    InitializeRegisters(state);
+    InitializeMemory(state);
+    MachineConnect(state, &device);
+
+    if (!state->memory)
+    {
+        printf("error: Unable to allocate memory for 8080 memory.\n");
+        exit(1);
+    }
+
+    memset(state->memory, 0, MEMORY_SIZE);
+    state->cycles = 0;
+
+    FILE *fp = fopen(rom_path, "rb");
+
+    if (fp == NULL)
+    {
+        printf("error: Couldn't open %s\n", rom_path);
+        exit(1);
+    }
+
+    // set the pointer at the end of the file to get the size
+    fseek(fp, 0, SEEK_END);
+    int fsize = ftell(fp);
+
+    // put the cursor back at the beginning
+    fseek(fp, 0, SEEK_SET);
+
+    if (fsize > 0x2000)
+    {
+        fsize = 0x2000;
+    }
+
+    fread(state->memory, fsize, 1, fp);
+    fclose(fp);
+
+    HashMemory(state);
+
+#if FUSE_OPCODES
+    InitializeFused();
+#endif
+
+#if HLE_ROUTINES
+    InitializeHle();
+#endif
+
+    if (hashed)
+    {
+        RunHashed(state, frames);
+        return 0;
+    }
+
+    if (scale)
+    {
+        RunScale(state, frames);
+        return 0;
+    }
+
+    if (phosphor)
+    {
+        RunPhosphor(state, frames);
+        return 0;
+    }
+
+    if (wav_path)
+    {
+        RunWav(state, wav_path, rate, frames);
+        return 0;
+    }
+
+    if (overlay_path && !record_path)
+    {
+        RunOverlay(state, overlay_path, frames);
+        return 0;
+    }
+
+    if (dirty)
+    {
+        RunDirty(state, frames);
+        return 0;
+    }
+
+    if (run_ahead >= 0)
+    {
+        RunRunAhead(state, run_ahead);
+        return 0;
+    }
+
+    if (envs)
+    {
+        RunEnvs(state->memory, fsize, envs, threads, frames, observe_width, observe_height);
+        return 0;
+    }
+
+    if (observe_width)
+    {
+        RunObserve(state, observe_width, observe_height, frames);
+        return 0;
+    }
+
+    if (forks)
+    {
+        RunForks(state, forks, frames);
+        return 0;
+    }
+
+    if (export_name && !ExportOpen(export_name))
+    {
+        printf("error: Couldn't set up the shared memory %s\n", export_name);
+        exit(1);
+    }
+
+    static Recorder recorder;
+    static Overlay record_overlay;
+    if (record_path)
+    {
+        if (overlay_path && !OverlayLoad(&record_overlay, overlay_path))
+        {
+            printf("error: Couldn't load the overlay %s\n", overlay_path);
+            exit(1);
+        }
+        if (!RecorderOpen(&recorder, record_path, overlay_path ? &record_overlay : NULL, !realtime))
+        {
+            printf("error: Couldn't record to %s\n", record_path);
+            exit(1);
+        }
+    }
+
+    FrameLog frame_log;
+    if (framelog_path && !FrameLogOpen(&frame_log, framelog_path))
+    {
+        printf("error: Couldn't write %s\n", framelog_path);
+        exit(1);
+    }
+
+    clock_t start = clock();
+    long long wall_start = PacerNow();
+    double record_seconds = 0;
+    double framelog_seconds = 0;
+
+    Pacer pacer;
+    PacerInit(&pacer, state->cycles);
+
+    int frame;
+    for (frame = 0; frame < frames; frame++)
+    {
+        MachineRunFrame(state);
+        if (framelog_path)
+        {
+            double begin = ThreadSeconds();
+            FrameLogAdd(&frame_log, state->memory + 0x2400);
+            framelog_seconds += ThreadSeconds() - begin;
+        }
+        if (record_path)
+        {
+            // this thread's CPU time, on one core the writer can get scheduled in between
+            double begin = ThreadSeconds();
+            RecorderFrame(&recorder, state->memory + 0x2400);
+            record_seconds += ThreadSeconds() - begin;
+        }
+        if (realtime)
+        {
+            PacerWait(&pacer, state->cycles);
+        }
+    }
+
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("Frames: %d\n", frames);
+    printf("Instructions: %llu\n", instruction_count);
+    printf("Dispatches: %llu (%.3f instructions per dispatch)\n", dispatch_count, (double)instruction_count / dispatch_count);
+    printf("Cycles: %llu\n", (unsigned long long)state->cycles);
+    printf("Time: %.3f s, %.2f emulated MHz, %.1fx real time\n", seconds, state->cycles / seconds / 1e6, frames / FRAMES_PER_SECOND / seconds);
+    if (realtime)
+    {
+        // clock() above is CPU time, so this is how much of the host the pacing costs
+        double wall = (PacerNow() - wall_start) / 1e9;
+        printf("Wall time: %.3f s for %.3f s emulated, host CPU %.1f%%\n", wall, state->cycles / (double)CPU_HZ, 100 * seconds / wall);
+        PacerReport(&pacer);
+    }
+    if (framelog_path)
+    {
+        FrameLogClose(&frame_log);
+        printf("Frame log: %ld frames to %s, %.2f us per frame\n", frame_log.frames, framelog_path,
+               framelog_seconds * 1e6 / frames);
+    }
+    if (record_path)
+    {
+        long long close_start = PacerNow();
+        RecorderClose(&recorder);
+        printf("Recorded %ld frames to %s, %ld written and %ld dropped (repeated), %.2f us per frame queuing them, "
+               "%.3f s finishing the file\n",
+               recorder.frames, record_path, recorder.frames - recorder.dropped, recorder.dropped,
+               record_seconds * 1e6 / frames,
+               (PacerNow() - close_start) / 1e9);
+    }
+
+#if HLE_ROUTINES
+    if (hle_mode != HLE_OFF)
+    {
+        HleReport();
+    }
+#endif
+
+#if PROFILE_OPCODES
+    ProfileReport(fused_top, "fused_ops.h");
+#endif
+
+    if (export_name)
+    {
+        ExportClose();
+        ExportRemove(export_name);
+    }
+
+    return 0;
+}
@@ -0,0 +1,397 @@
+#include <string.h>
+
+int MachineStep(State8080 *state);
+
+// High-level emulation of known invaders.rom subroutines.
+// When PC reaches the entry of a routine in hle_routines, a native C version
+// runs instead of the 8080 code:
+//   HLE_FAST   only the native version runs
+//   HLE_VERIFY both run, the native one on a copy of the machine, and any
+//              difference in registers, flags, cycles, memory, shift
+//              register or port latches is reported. The emulated result
+//              is the one kept.
+// The native versions reproduce what this core does, flags included, and
+// charge the same cycles, so a routine is only replaced when it finishes
+// before the next interrupt (otherwise the interpreter runs it).
+
+#define HLE_OFF 0
+#define HLE_VERIFY 1
+#define HLE_FAST 2
+
+typedef void (*NativeRoutine)(State8080 *state);
+
+typedef struct HleRoutine
+{
+    uint16_t address;
+    const char *name;
+    NativeRoutine routine;
+
+    // what the interpreter charges: fixed + per_row * B
+    unsigned int fixed_cycles;
+    unsigned int row_cycles;
+} HleRoutine;
+
+int hle_mode = HLE_OFF;
+
+// RET to the address the CALL pushed
+void HleReturn(State8080 *state)
+{
+    state->pc = (state->memory[state->sp + 1] << 8) | state->memory[state->sp];
+    state->sp += 2;
+}
+
+// IN and OUT, through the machine's port handlers like the 8080 code's
+uint8_t HleIn(State8080 *state, uint8_t port)
+{
+    return state->ports->read[port] ? state->ports->read[port](state, port) : 0;
+}
+
+void HleOut(State8080 *state, uint8_t port, uint8_t value)
+{
+    if (state->ports->write[port])
+    {
+        state->ports->write[port](state, port, value);
+    }
+}
+
+void HleSetHL(State8080 *state, uint16_t hl)
+{
+    state->h = hl >> 8;
+    state->l = hl & 0xff;
+}
+
+// $1474 CnvtPixNumber: pixel number in HL -> screen address in HL,
+// low 3 bits go to the shift amount (port 2)
+void HlePixelToScreen(State8080 *state)
+{
+    uint16_t hl = (state->h << 8) | state->l;
+
+    HleOut(state, 2, state->l & 0x07);
+
+    HleSetHL(state, (hl >> 3) | 0x2000);
+
+    // ends with ANI $3f; ORI $20; MOV H,A
+    state->a = state->h;
+    SetFlags(state, state->a);
+    state->cc.cy = 0;
+    state->cc.ac = 0;
+}
+
+// every sprite loop ends on DCR B reaching 0
+void HleLoopDone(State8080 *state)
+{
+    state->b = 0;
+    SetFlags(state, state->b);
+}
+
+int HleRows(State8080 *state)
+{
+    return (state->b == 0) ? 256 : state->b;
+}
+
+// $1400 DrawShiftedSprite: sprite at DE, B rows, ORed onto the screen two bytes wide
+void HleDrawShiftedSprite(State8080 *state)
+{
+    int rows = HleRows(state);
+    uint16_t de = (state->d << 8) | state->e;
+    int row;
+
+    HlePixelToScreen(state);
+    uint16_t hl = (state->h << 8) | state->l;
+
+    for (row = 0; row < rows; row++)
+    {
+        HleOut(state, 4, state->memory[de]);
+        state->a = HleIn(state, 3) | state->memory[hl];
+        WriteMemory(state, hl, state->a);
+
+        HleOut(state, 4, 0);
+        state->a = HleIn(state, 3) | state->memory[(uint16_t)(hl + 1)];
+        WriteMemory(state, hl + 1, state->a);
+
+        de++;
+        hl += 0x20;
+    }
+
+    state->d = de >> 8;
+    state->e = de & 0xff;
+    HleSetHL(state, hl);
+    HleLoopDone(state);
+    HleReturn(state);
+}
+
+// $1424 EraseSimpleSprite: clears B rows, two bytes wide
+void HleEraseSimpleSprite(State8080 *state)
+{
+    int rows = HleRows(state);
+    int row;
+
+    HlePixelToScreen(state);
+    uint16_t hl = (state->h << 8) | state->l;
+
+    for (row = 0; row < rows; row++)
+    {
+        WriteMemory(state, hl, 0);
+        WriteMemory(state, hl + 1, 0);
+        hl += 0x20;
+    }
+
+    state->a = 0;
+    HleSetHL(state, hl);
+    HleLoopDone(state);
+    HleReturn(state);
+}
+
+// $1452 EraseShifted: clears the shifted sprite at DE out of the screen (AND NOT)
+void HleEraseShifted(State8080 *state)
+{
+    int rows = HleRows(state);
+    uint16_t de = (state->d << 8) | state->e;
+    int row;
+
+    HlePixelToScreen(state);
+    uint16_t hl = (state->h << 8) | state->l;
+
+    for (row = 0; row < rows; row++)
+    {
+        HleOut(state, 4, state->memory[de]);
+        state->a = ~HleIn(state, 3) & state->memory[hl];
+        WriteMemory(state, hl, state->a);
+
+        HleOut(state, 4, 0);
+        state->a = ~HleIn(state, 3) & state->memory[(uint16_t)(hl + 1)];
+        WriteMemory(state, hl + 1, state->a);
+
+        de++;
+        hl += 0x20;
+    }
+
+    state->d = de >> 8;
+    state->e = de & 0xff;
+    HleSetHL(state, hl);
+    HleLoopDone(state);
+    HleReturn(state);
+}
+
+// $15d3 DrawSprite: like DrawShiftedSprite but overwrites the screen,
+// and gives back the screen address in HL
+void HleDrawSprite(State8080 *state)
+{
+    int rows = HleRows(state);
+    uint16_t de = (state->d << 8) | state->e;
+    int row;
+
+    HlePixelToScreen(state);
+    uint16_t screen = (state->h << 8) | state->l;
+    uint16_t hl = screen;
+
+    for (row = 0; row < rows; row++)
+    {
+        HleOut(state, 4, state->memory[de]);
+        state->a = HleIn(state, 3);
+        WriteMemory(state, hl, state->a);
+
+        HleOut(state, 4, 0);
+        state->a = HleIn(state, 3);
+        WriteMemory(state, hl + 1, state->a);
+
+        de++;
+        hl += 0x20;
+    }
+
+    state->d = de >> 8;
+    state->e = de & 0xff;
+    HleSetHL(state, screen);
+    HleLoopDone(state);
+    HleReturn(state);
+}
+
+// $1439 DrawSimpSprite: B bytes from DE straight to the screen at HL, one per row
+void HleDrawSimpleSprite(State8080 *state)
+{
+    int rows = HleRows(state);
+    uint16_t de = (state->d << 8) | state->e;
+    uint16_t hl = (state->h << 8) | state->l;
+    int row;
+
+    for (row = 0; row < rows; row++)
+    {
+        state->a = state->memory[de];
+        WriteMemory(state, hl, state->a);
+        de++;
+        hl += 0x20;
+    }
+
+    state->d = de >> 8;
+    state->e = de & 0xff;
+    HleSetHL(state, hl);
+    HleLoopDone(state);
+    HleReturn(state);
+}
+
+const HleRoutine hle_routines[] = {
+    {0x1400, "DrawShiftedSprite", HleDrawShiftedSprite, 243, 107},
+    {0x1424, "EraseSimpleSprite", HleEraseSimpleSprite, 235, 84},
+    {0x1439, "DrawSimpSprite", HleDrawSimpleSprite, 10, 65},
+    {0x1452, "EraseShifted", HleEraseShifted, 235, 119},
+    {0x15d3, "DrawSprite", HleDrawSprite, 248, 103},
+};
+
+#define HLE_COUNT (int)(sizeof(hle_routines) / sizeof(hle_routines[0]))
+
+// index + 1 into hle_routines for each ROM address, 0 if nothing is hooked there
+uint8_t hle_at[0x2000];
+
+// set while the emulated side of a verify runs, so it doesn't hook itself
+MACHINE_LOCAL int hle_busy = 0;
+
+// per thread like the rest of the machine layer (env.c runs machines on
+// several), HleReport shows the calling thread's counts
+MACHINE_LOCAL unsigned long long hle_calls[HLE_COUNT];
+MACHINE_LOCAL unsigned long long hle_mismatches[HLE_COUNT];
+
+// scratch machine for the native side of a verify
+MACHINE_LOCAL State8080 hle_native;
+MACHINE_LOCAL uint8_t hle_native_memory[ADDRESS_SPACE];
+MACHINE_LOCAL MachineDevice hle_native_device;
+
+void InitializeHle()
+{
+    int i;
+    for (i = 0; i < HLE_COUNT; i++)
+    {
+        hle_at[hle_routines[i].address] = i + 1;
+    }
+}
+
+int HleCompare(int index, State8080 *native, State8080 *emulated, uint16_t lowest_sp)
+{
+    MachineDevice *native_device = MachineDeviceOf(native), *emulated_device = MachineDeviceOf(emulated);
+    ShiftRegister *native_shift = &native_device->shift;
+    ShiftRegister *emulated_shift = &emulated_device->shift;
+    int same = native->a == emulated->a && native->b == emulated->b && native->c == emulated->c &&
+               native->d == emulated->d && native->e == emulated->e && native->h == emulated->h &&
+               native->l == emulated->l && native->sp == emulated->sp && native->pc == emulated->pc &&
+               native->cc.s == emulated->cc.s && native->cc.z == emulated->cc.z && native->cc.ac == emulated->cc.ac &&
+               native->cc.p == emulated->cc.p && native->cc.cy == emulated->cc.cy &&
+               native->cycles == emulated->cycles &&
+               memcmp(native_shift, emulated_shift, sizeof(ShiftRegister)) == 0 &&
+               memcmp(native_device->w_port, emulated_device->w_port, sizeof(native_device->w_port)) == 0;
+
+    // the stack below SP is dead once the routine returned, the native side never wrote it
+    int first_difference = -1;
+    int address;
+    for (address = 0; address < MEMORY_SIZE; address++)
+    {
+        if (address >= lowest_sp && address < emulated->sp)
+        {
+            continue;
+        }
+        if (native->memory[address] != emulated->memory[address])
+        {
+            first_difference = address;
+            same = FALSE;
+            break;
+        }
+    }
+
+    // only the first mismatch of each routine gets the details
+    if (!same && hle_mismatches[index] == 0)
+    {
+        const HleRoutine *hook = &hle_routines[index];
+
+        printf("HLE %s at $%04x differs from the ROM code\n", hook->name, hook->address);
+        printf("  native:   A %02x BC %02x%02x DE %02x%02x HL %02x%02x SP %04x PC %04x SZAPC %d%d%d%d%d cycles %llu\n",
+               native->a, native->b, native->c, native->d, native->e, native->h, native->l, native->sp, native->pc,
+               native->cc.s, native->cc.z, native->cc.ac, native->cc.p, native->cc.cy, (unsigned long long)native->cycles);
+        printf("  emulated: A %02x BC %02x%02x DE %02x%02x HL %02x%02x SP %04x PC %04x SZAPC %d%d%d%d%d cycles %llu\n",
+               emulated->a, emulated->b, emulated->c, emulated->d, emulated->e, emulated->h, emulated->l, emulated->sp, emulated->pc,
+               emulated->cc.s, emulated->cc.z, emulated->cc.ac, emulated->cc.p, emulated->cc.cy, (unsigned long long)emulated->cycles);
+        printf("  shift:    native %02x%02x>>%d emulated %02x%02x>>%d\n",
+               native_shift->shift_reg_hi, native_shift->shift_reg_lo, native_shift->shift_offset,
+               emulated_shift->shift_reg_hi, emulated_shift->shift_reg_lo, emulated_shift->shift_offset);
+        if (first_difference >= 0)
+        {
+            printf("  memory:   $%04x native %02x emulated %02x\n", first_difference,
+                   native->memory[first_difference], emulated->memory[first_difference]);
+        }
+    }
+
+    return same;
+}
+
+// Runs the hooked routine at PC, if any, according to hle_mode.
+// Returns TRUE if the routine ran (PC is then back at the caller)
+int RunHle(State8080 *state, uint64_t deadline)
+{
+    if (hle_mode == HLE_OFF || hle_busy || state->pc >= 0x2000 || !hle_at[state->pc])
+    {
+        return FALSE;
+    }
+
+    int index = hle_at[state->pc] - 1;
+    const HleRoutine *hook = &hle_routines[index];
+    unsigned int cost = hook->fixed_cycles + hook->row_cycles * HleRows(state);
+
+    if (deadline && (int)(deadline - state->cycles) <= (int)cost)
+    {
+        // the interrupt lands in the middle of it, let the interpreter run it
+        return FALSE;
+    }
+
+    hle_calls[index]++;
+
+    if (hle_mode == HLE_FAST)
+    {
+        hook->routine(state);
+        state->cycles += cost;
+        return TRUE;
+    }
+
+    // native side on a copy, that nobody hears
+    hle_native = *state;
+    hle_native.memory = hle_native_memory;
+    hle_native.write_hook = NULL;
+    memcpy(hle_native_memory, state->memory, ADDRESS_SPACE);
+    hle_native_device = *MachineDeviceOf(state);
+    hle_native_device.sound = NULL;
+    hle_native.device = &hle_native_device;
+
+    hook->routine(&hle_native);
+    hle_native.cycles += cost;
+
+    // emulated side on the real machine, until the RET
+    uint16_t entry_sp = state->sp;
+    uint16_t lowest_sp = state->sp;
+    int steps = 0;
+
+    hle_busy = 1;
+    while (state->sp != (uint16_t)(entry_sp + 2) && steps < 1000000)
+    {
+        MachineStep(state);
+        if (state->sp < lowest_sp)
+        {
+            lowest_sp = state->sp;
+        }
+        steps++;
+    }
+    hle_busy = 0;
+
+    if (!HleCompare(index, &hle_native, state, lowest_sp))
+    {
+        hle_mismatches[index]++;
+    }
+
+    return TRUE;
+}
+
+void HleReport()
+{
+    int i;
+    printf("\nHLE routines (%s)\n", (hle_mode == HLE_FAST) ? "fast" : (hle_mode == HLE_VERIFY) ? "verify" : "off");
+    for (i = 0; i < HLE_COUNT; i++)
+    {
+        printf("  $%04x %-20s %10llu calls %10llu mismatches\n", hle_routines[i].address, hle_routines[i].name,
+               hle_calls[i], hle_mismatches[i]);
+    }
+}
@@ -0,0 +1,487 @@
+#include <string.h>
+
+// Idiom recognition for the byte-at-a-time loops the game uses to copy and
+// clear memory (e.g. $1a32 and $1a5f in invaders.rom).
+// When PC is at the top of one of these loops, the first iteration runs through
+// the interpreter (that tells us the cycles of one pass), the middle ones run as
+// a single memmove/memset, and the last one is left to the interpreter. That way
+// registers, flags and cycles end exactly where the loop would have left them.
+//
+// Same for the loops that wait for an interrupt by polling a byte of RAM that
+// only the interrupt handlers change: $0ada (LDA; ANA A; JNZ) and $0a9e (LDA;
+// DCR A; JNZ) wait for the screen halves, $0a85 kicks the watchdog while it
+// waits (OUT 6; LDA; ANA A; JZ). Nothing in them changes what they read, so
+// once the first pass went round every pass is the same: the ones that end
+// before the interrupt are only counted, calling the port handler of the OUT
+// as each would have.
+//
+// And for the loops that look at a row of bytes, $15c7 (is anything in this
+// screen column, MOV A,M; ANA A; JNZ out) and $15f9 (how many aliens are left,
+// MOV A,M; ANA A; JZ over an INR C), both then INX H; DCR B; JNZ loop: the
+// passes up to the first byte that ends the loop are done by looking at the
+// bytes, their cycles coming from the core run on a copy of the registers.
+
+enum
+{
+    IDIOM_COPY, // (source) -> (dest), both incremented
+    IDIOM_FILL, // value -> (HL), HL incremented
+};
+
+// the most bytes any of the shapes looks at from PC, the scan loop with a JZ
+#define IDIOM_LONGEST 11
+
+typedef struct BlockLoop
+{
+    int kind;
+    int instructions; // per iteration, including the JNZ
+    int bytes;        // size of the loop code
+    int iterations;   // including the one about to run
+    uint8_t *counter; // register decremented by the loop, NULL if it ends on H
+    uint8_t *source_hi, *source_lo;
+    uint8_t *dest_hi, *dest_lo;
+    uint8_t value;
+} BlockLoop;
+
+// register decremented by DCR B / DCR C
+uint8_t *IdiomCounter(State8080 *state, uint8_t op)
+{
+    if (op == 0x05)
+    {
+        return &state->b;
+    }
+    if (op == 0x0d)
+    {
+        return &state->c;
+    }
+    return NULL;
+}
+
+// INX H; INX D in either order
+int IdiomIncrementsBoth(uint8_t *code)
+{
+    return (code[0] == 0x23 && code[1] == 0x13) || (code[0] == 0x13 && code[1] == 0x23);
+}
+
+// JNZ back to the top of the loop
+int IdiomLoopsBack(State8080 *state, uint8_t *code)
+{
+    return code[0] == 0xc2 && ((code[2] << 8) | code[1]) == state->pc;
+}
+
+// Fills in loop if the code at PC is one of the known shapes
+int MatchBlockLoop(State8080 *state, BlockLoop *loop)
+{
+    uint8_t *code = &state->memory[state->pc];
+
+    loop->counter = NULL;
+
+    switch (code[0])
+    {
+    case 0x1a:
+        // LDAX D; MOV M,A; INX H; INX D; DCR B/C; JNZ loop
+        if (code[1] != 0x77 || !IdiomIncrementsBoth(&code[2]) || !IdiomLoopsBack(state, &code[5]))
+        {
+            return FALSE;
+        }
+        loop->kind = IDIOM_COPY;
+        loop->instructions = 6;
+        loop->bytes = 8;
+        loop->counter = IdiomCounter(state, code[4]);
+        loop->source_hi = &state->d;
+        loop->source_lo = &state->e;
+        loop->dest_hi = &state->h;
+        loop->dest_lo = &state->l;
+        break;
+
+    case 0x7e:
+        // MOV A,M; STAX D; INX D; INX H; DCR B/C; JNZ loop
+        if (code[1] != 0x12 || !IdiomIncrementsBoth(&code[2]) || !IdiomLoopsBack(state, &code[5]))
+        {
+            return FALSE;
+        }
+        loop->kind = IDIOM_COPY;
+        loop->instructions = 6;
+        loop->bytes = 8;
+        loop->counter = IdiomCounter(state, code[4]);
+        loop->source_hi = &state->h;
+        loop->source_lo = &state->l;
+        loop->dest_hi = &state->d;
+        loop->dest_lo = &state->e;
+        break;
+
+    case 0x77:
+        // MOV M,A; INX H; DCR B/C; JNZ loop
+        if (code[1] != 0x23 || !IdiomLoopsBack(state, &code[3]))
+        {
+            return FALSE;
+        }
+        loop->kind = IDIOM_FILL;
+        loop->instructions = 4;
+        loop->bytes = 6;
+        loop->counter = IdiomCounter(state, code[2]);
+        loop->value = state->a;
+        break;
+
+    case 0x36:
+        // MVI M,data; INX H; DCR B/C; JNZ loop
+        if (code[2] == 0x23 && IdiomLoopsBack(state, &code[4]))
+        {
+            loop->kind = IDIOM_FILL;
+            loop->instructions = 4;
+            loop->bytes = 7;
+            loop->counter = IdiomCounter(state, code[3]);
+            loop->value = code[1];
+            break;
+        }
+
+        // MVI M,data; INX H; MOV A,H; CPI end; JNZ loop
+        if (code[2] == 0x23 && code[3] == 0x7c && code[4] == 0xfe && IdiomLoopsBack(state, &code[6]))
+        {
+            uint16_t hl = (state->h << 8) | state->l;
+            uint16_t left = (code[5] << 8) - hl;
+
+            loop->kind = IDIOM_FILL;
+            loop->instructions = 5;
+            loop->bytes = 9;
+            loop->iterations = (left == 0) ? 0x10000 : left;
+            loop->value = code[1];
+            loop->dest_hi = &state->h;
+            loop->dest_lo = &state->l;
+            return TRUE;
+        }
+        return FALSE;
+
+    default:
+        return FALSE;
+    }
+
+    if (loop->counter == NULL)
+    {
+        return FALSE;
+    }
+
+    loop->iterations = (*loop->counter == 0) ? 256 : *loop->counter;
+    if (loop->kind == IDIOM_FILL)
+    {
+        loop->dest_hi = &state->h;
+        loop->dest_lo = &state->l;
+    }
+    return TRUE;
+}
+
+void IdiomAdvance(uint8_t *hi, uint8_t *lo, int count)
+{
+    uint16_t pair = ((*hi << 8) | *lo) + count;
+    *hi = pair >> 8;
+    *lo = pair & 0xff;
+}
+
+// register incremented by INR C / INR D / INR E
+uint8_t *IdiomIncremented(State8080 *state, uint8_t op)
+{
+    if (op == 0x0c)
+    {
+        return &state->c;
+    }
+    if (op == 0x14)
+    {
+        return &state->d;
+    }
+    if (op == 0x1c)
+    {
+        return &state->e;
+    }
+    return NULL;
+}
+
+// Cycles of one pass of the scan loop at PC reading value, from the core on a
+// copy of the registers (nothing in a pass writes memory)
+unsigned int IdiomScanPass(State8080 *state, uint8_t value)
+{
+    State8080 copy = *state;
+    int i;
+
+    // MOV A,M, then the rest of the pass with A = value, looping back
+    copy.b = 2;
+    copy.c = 2;
+    copy.pc += Execute8080(&copy, copy.memory[copy.pc]);
+    copy.a = value;
+    for (i = 0; i < 8 && copy.pc != state->pc; i++)
+    {
+        copy.pc += Execute8080(&copy, copy.memory[copy.pc]);
+    }
+    return copy.cycles - state->cycles;
+}
+
+// Runs the passes of the scan loop at PC that read 0 (or any byte, for the
+// counting one) up to the last but one and not past deadline. Returns the
+// number of instructions executed, 0 if PC is not at a scan loop
+int RunScanLoop(State8080 *state, uint64_t deadline)
+{
+    uint8_t *code = &state->memory[state->pc];
+    uint8_t *counter, *counted = NULL;
+    int exits;
+
+    if (code[2] == 0xc2 && code[5] == 0x23 && IdiomLoopsBack(state, &code[7]))
+    {
+        // MOV A,M; ANA A; JNZ out; INX H; DCR B/C; JNZ loop
+        exits = TRUE;
+        counter = IdiomCounter(state, code[6]);
+    }
+    else if (code[2] == 0xca && ((code[4] << 8) | code[3]) == state->pc + 6 && code[6] == 0x23 &&
+             IdiomLoopsBack(state, &code[8]))
+    {
+        // MOV A,M; ANA A; JZ next; INR C/D/E; next: INX H; DCR B/C; JNZ loop
+        exits = FALSE;
+        counter = IdiomCounter(state, code[7]);
+        counted = IdiomIncremented(state, code[5]);
+        if (counted == NULL || counted == counter)
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (counter == NULL)
+    {
+        return 0;
+    }
+
+    int iterations = (*counter == 0) ? 256 : *counter;
+    unsigned int zero_cycles = IdiomScanPass(state, 0);
+    unsigned int other_cycles = exits ? 0 : IdiomScanPass(state, 1);
+    uint16_t hl = (state->h << 8) | state->l;
+    uint64_t cycles = state->cycles;
+    uint8_t last = state->a;
+    int passes, found = 0;
+
+    // the last pass, and the one that jumps out, are the interpreter's
+    for (passes = 0; passes < iterations - 1; passes++)
+    {
+        uint8_t byte = state->memory[(uint16_t)(hl + passes)];
+        unsigned int pass_cycles = byte ? other_cycles : zero_cycles;
+
+        if ((exits && byte) || (deadline && (int)(cycles + pass_cycles - deadline) >= 0))
+        {
+            break;
+        }
+        cycles += pass_cycles;
+        found += (byte != 0);
+        last = byte;
+    }
+
+    if (passes == 0)
+    {
+        return 0;
+    }
+
+    // where the passes leave things: A the last byte, flags from the DCR
+    state->a = last;
+    IdiomAdvance(&state->h, &state->l, passes);
+    *counter -= passes;
+    if (counted)
+    {
+        *counted += found;
+    }
+    SetFlags(state, *counter);
+    state->cycles = cycles;
+
+    return 6 * passes + found;
+}
+
+// Instructions per pass if the code at PC is a spin-wait (OUT port; LDA adr;
+// ANA A, ORA A or DCR A; JNZ or JZ back to PC), 0 if not. *port is the port of
+// the OUT, -1 if there's none
+int MatchSpinWait(State8080 *state, int *port)
+{
+    uint8_t *code = &state->memory[state->pc];
+
+    *port = -1;
+    if (code[0] == 0xd3)
+    {
+        *port = code[1];
+        code += 2;
+    }
+
+    if (code[0] != 0x3a || (code[3] != 0xa7 && code[3] != 0xb7 && code[3] != 0x3d) ||
+        (code[4] != 0xc2 && code[4] != 0xca) || ((code[6] << 8) | code[5]) != state->pc)
+    {
+        return 0;
+    }
+    return (*port < 0) ? 3 : 4;
+}
+
+// Runs a spin-wait at PC up to the last pass that ends before deadline.
+// Returns the number of instructions executed, 0 if PC is not at one or there's
+// no deadline (the loop would never end then)
+int RunSpinWait(State8080 *state, uint64_t deadline)
+{
+    uint16_t top = state->pc;
+    int port;
+    int instructions = MatchSpinWait(state, &port);
+    int i;
+
+    if (instructions == 0 || !deadline)
+    {
+        return 0;
+    }
+
+    // first pass through the interpreter, noting when the OUT's handler ran
+    uint64_t start = state->cycles;
+    unsigned int out_cycles = 0;
+    for (i = 0; i < instructions; i++)
+    {
+        state->pc += Emulate8080(state);
+        if (i == 0)
+        {
+            out_cycles = state->cycles - start;
+        }
+
+        if ((int)(state->cycles - deadline) >= 0)
+        {
+            return i + 1;
+        }
+    }
+
+    unsigned int pass_cycles = state->cycles - start;
+    if (state->pc != top || pass_cycles == 0)
+    {
+        return instructions;
+    }
+
+    int left = (int)(deadline - state->cycles) - 1;
+    int passes = (left > 0) ? left / pass_cycles : 0;
+
+    if (port >= 0 && state->ports && state->ports->write[port])
+    {
+        for (i = 0; i < passes; i++)
+        {
+            uint64_t pass_start = state->cycles;
+            state->cycles += out_cycles;
+            state->ports->write[port](state, port, state->a);
+            state->cycles = pass_start + pass_cycles;
+        }
+    }
+    else
+    {
+        state->cycles += passes * pass_cycles;
+    }
+
+    return instructions * (1 + passes);
+}
+
+// Runs a whole block loop (or spin-wait, or scan loop) at PC except its last iteration,
+// without going past deadline (the cycle count of the next interrupt, 0 for no
+// limit). Returns the number of instructions executed, 0 if PC is not at such a
+// loop
+int RunIdiom(State8080 *state, uint64_t deadline)
+{
+    BlockLoop loop;
+    uint16_t top = state->pc;
+    int i;
+
+    // too close to the end of memory to hold any of them, and matching
+    // would read past it
+    if (top + IDIOM_LONGEST > ADDRESS_SPACE)
+    {
+        return 0;
+    }
+
+    if (state->memory[top] == 0x3a || state->memory[top] == 0xd3)
+    {
+        return RunSpinWait(state, deadline);
+    }
+
+    if (state->memory[top] == 0x7e && state->memory[top + 1] == 0xa7)
+    {
+        return RunScanLoop(state, deadline);
+    }
+
+    if (!MatchBlockLoop(state, &loop) || loop.iterations < 3)
+    {
+        return 0;
+    }
+
+    // first iteration through the interpreter
+    uint64_t start = state->cycles;
+    for (i = 0; i < loop.instructions; i++)
+    {
+        state->pc += Emulate8080(state);
+
+        if (deadline && (int)(state->cycles - deadline) >= 0)
+        {
+            // the interrupt is due, same as stepping one by one
+            return i + 1;
+        }
+    }
+
+    unsigned int iteration_cycles = state->cycles - start;
+    int bulk = loop.iterations - 2;
+
+    if (state->pc != top || iteration_cycles == 0)
+    {
+        return loop.instructions;
+    }
+
+    if (deadline)
+    {
+        // stop while the interpreter would still be before the interrupt
+        int left = (int)(deadline - state->cycles) - 1;
+        int fit = (left > 0) ? left / iteration_cycles : 0;
+        if (bulk > fit)
+        {
+            bulk = fit;
+        }
+    }
+
+    uint16_t dest = (*loop.dest_hi << 8) | *loop.dest_lo;
+    uint16_t source = (loop.kind == IDIOM_COPY) ? ((*loop.source_hi << 8) | *loop.source_lo) : 0;
+
+    // leave to the interpreter anything that runs off the end of memory,
+    // overwrites the loop itself, or copies onto its own source ahead of it
+    // (a byte loop repeats the pattern there, memmove wouldn't)
+    if (bulk <= 0 || dest + bulk > MEMORY_SIZE || (dest < top + loop.bytes && dest + bulk > top))
+    {
+        return loop.instructions;
+    }
+
+    if (loop.kind == IDIOM_COPY && (source + bulk > MEMORY_SIZE || (dest > source && dest < source + bulk)))
+    {
+        return loop.instructions;
+    }
+
+#if STATE_HASH
+    HashMemoryRange(state, dest, bulk);
+#endif
+
+    if (loop.kind == IDIOM_COPY)
+    {
+        memmove(&state->memory[dest], &state->memory[source], bulk);
+        IdiomAdvance(loop.source_hi, loop.source_lo, bulk);
+    }
+    else
+    {
+        memset(&state->memory[dest], loop.value, bulk);
+    }
+
+#if STATE_HASH
+    HashMemoryRange(state, dest, bulk);
+#endif
+
+    if (state->write_hook)
+    {
+        state->write_hook(state, dest, bulk);
+    }
+
+    IdiomAdvance(loop.dest_hi, loop.dest_lo, bulk);
+    if (loop.counter)
+    {
+        *loop.counter -= bulk;
+    }
+    state->cycles += bulk * iteration_cycles;
+
+    return loop.instructions * (1 + bulk);
+}
@@ -0,0 +1,296 @@
+#include "8080.c"
+#include <stdbool.h>
+
+// The Space Invaders hardware around the CPU: ports, shift register, interrupts.
+// No SDL in here so the headless tools can share it with SpaceInvaders.c
+
+#if PROFILE_OPCODES
+#include "profile.c"
+#endif
+
+#if FUSE_OPCODES
+#include "fuse.c"
+#endif
+
+#if IDIOM_LOOPS
+#include "idiom.c"
+#endif
+
+#if THREADED_CORE
+#include "threaded.c"
+#endif
+
+// 1.9968 MHz CPU (19.968 MHz crystal / 10), 59.54 frames per second
+#define CPU_HZ 1996800
+#define FRAMES_PER_SECOND 59.54
+#define CYCLES_PER_FRAME 33537
+
+typedef struct ShiftRegister
+{
+    uint8_t shift_reg_lo; // shift_reg[0]
+    uint8_t shift_reg_hi; // shift_reg[1]
+    uint8_t shift_offset;
+
+} ShiftRegister;
+
+// instructions executed vs. times we went through the dispatch in MachineStep
+MACHINE_LOCAL unsigned long long instruction_count = 0;
+MACHINE_LOCAL unsigned long long dispatch_count = 0;
+
+// cycle count of the next interrupt, set by MachineRunFrame (0 when nobody is counting)
+// so that work done in bulk stops where the interpreter would have been interrupted
+MACHINE_LOCAL uint64_t cycle_deadline = 0;
+
+#include "sound.c"
+
+// The board behind the ports, one per machine (its state->device, see
+// MachineConnect): the inputs, the last value written to each port, the shift
+// register and the sound that ports 3 and 5 drive
+typedef struct MachineDevice
+{
+    ShiftRegister shift;
+    uint8_t r_port[4];
+    uint8_t w_port[7];
+    Sound *sound; // NULL for no sound
+} MachineDevice;
+
+static inline MachineDevice *MachineDeviceOf(State8080 *state)
+{
+    return (MachineDevice *)state->device;
+}
+
+// The port handlers (state->ports)
+uint8_t MachinePortRead(State8080 *state, uint8_t port)
+{
+    MachineDevice *device = MachineDeviceOf(state);
+    ShiftRegister *shift = &device->shift;
+
+    switch (port)
+    {
+    case 1:
+        // coin, start buttons and player 1 controls, bit 3 is always set
+        return device->r_port[1] | 0x08;
+    case 2:
+        // DIP switches (0: 3 ships) and player 2 controls
+        return device->r_port[2];
+    case 3:
+        // the shift register, through the window set by port 2
+        return (((shift->shift_reg_hi << 8) | shift->shift_reg_lo) >> (8 - shift->shift_offset)) & 0xff;
+    default:
+        // ports that aren't wired read as 0
+        return 0;
+    }
+}
+
+void MachinePortWrite(State8080 *state, uint8_t port, uint8_t value)
+{
+    MachineDevice *device = MachineDeviceOf(state);
+    ShiftRegister *shift = &device->shift;
+
+    device->w_port[port] = value;
+    switch (port)
+    {
+    case 2:
+        // set offset for the shifting
+        shift->shift_offset = value & 0x7;
+        break;
+    case 4:
+        // move high bits into low, and value into high
+        shift->shift_reg_lo = shift->shift_reg_hi;
+        shift->shift_reg_hi = value;
+        break;
+    case 3:
+    case 5:
+        if (device->sound)
+        {
+            SoundLatch(device->sound, state->cycles, port, value);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// 1, 2: inputs, 3: shift register result; 2, 4: shift register, 3, 5: sound,
+// 6: watchdog
+static const PortTable machine_ports = {
+    .read = {[1] = MachinePortRead, [2] = MachinePortRead, [3] = MachinePortRead},
+    .write = {[2] = MachinePortWrite, [3] = MachinePortWrite, [4] = MachinePortWrite,
+              [5] = MachinePortWrite, [6] = MachinePortWrite},
+};
+
+// Wires state's IN/OUT to the Space Invaders board, device being its own
+// (which stays the caller's, zeroed for a machine just switched on)
+void MachineConnect(State8080 *state, MachineDevice *device)
+{
+    state->ports = &machine_ports;
+    state->device = device;
+}
+
+// Hash of the whole machine: memory (kept up to date by WriteMemory), registers,
+// flags and the shift register. The cycle count is left out, it never repeats,
+// so compare hashes taken at the same point of a frame
+uint64_t MachineStateHash(State8080 *state)
+{
+    ShiftRegister *shift = &MachineDeviceOf(state)->shift;
+    uint64_t registers = ((uint64_t)state->a << 56) | ((uint64_t)state->b << 48) | ((uint64_t)state->c << 40) |
+                         ((uint64_t)state->d << 32) | ((uint64_t)state->e << 24) | ((uint64_t)state->h << 16) |
+                         ((uint64_t)state->l << 8) | (state->cc.s << 4) | (state->cc.z << 3) |
+                         (state->cc.ac << 2) | (state->cc.p << 1) | state->cc.cy;
+    uint64_t pointers = ((uint64_t)state->sp << 48) | ((uint64_t)state->pc << 32) | (state->int_enabled << 24) |
+                        (shift->shift_reg_hi << 16) | (shift->shift_reg_lo << 8) | shift->shift_offset;
+
+    // other offsets than ByteHash so registers don't hash like a memory byte
+    return state->memory_hash ^ Mix64(registers + 0x243f6a8885a308d3ULL) ^ Mix64(pointers + 0x13198a2e03707344ULL);
+}
+
+void Interrupt(State8080 *state, uint8_t int_num)
+{
+    // Basically the implementation of a RST function, which is a special CALL
+    // only difference is the value set into the PC
+    uint16_t ret = state->pc;
+    WriteMemory(state, (state->sp) - 2, ret & 0xFF); // PC.lo
+    WriteMemory(state, (state->sp) - 1, ret >> 8);   // PC.hi
+    state->sp = (state->sp) - 2;
+
+    state->pc = 8 * int_num;
+}
+
+#if HLE_ROUTINES
+#include "hle.c"
+#endif
+
+#if SHARED_EXPORT
+#include "export.c"
+#endif
+
+// End of a frame, where the VBlank interrupt (RST 2) comes, for whatever
+// watches the machine from outside
+void MachineVBlank(State8080 *state)
+{
+#if SHARED_EXPORT
+    if (export_region)
+    {
+        ExportPublish(export_region, state);
+    }
+#endif
+}
+
+// Runs the instruction at PC (or a whole fused sequence starting there)
+// and returns the number of instructions executed
+int MachineStep(State8080 *state)
+{
+#if HLE_ROUTINES
+    if (hle_mode != HLE_OFF && RunHle(state, cycle_deadline))
+    {
+        // verify ran the ROM code through MachineStep, which counted it already
+        if (hle_mode == HLE_FAST)
+        {
+            dispatch_count++;
+            instruction_count++;
+        }
+        return 1;
+    }
+#endif
+
+#if PROFILE_OPCODES || IDIOM_LOOPS || FUSE_OPCODES
+    uint8_t *code = &state->memory[state->pc];
+#endif
+
+#if PROFILE_OPCODES
+    ProfileInstruction(state->pc, *code);
+#endif
+
+    dispatch_count++;
+
+#if IDIOM_LOOPS
+    if (*code == 0x1a || *code == 0x7e || *code == 0x77 || *code == 0x36 || *code == 0x3a || *code == 0xd3)
+    {
+        int looped = RunIdiom(state, cycle_deadline);
+        if (looped)
+        {
+            instruction_count += looped;
+            return looped;
+        }
+    }
+#endif
+
+#if FUSE_OPCODES
+    if (fused_end[*code])
+    {
+        int ran = RunFused(state, cycle_deadline);
+        if (ran)
+        {
+            instruction_count += ran;
+            return ran;
+        }
+    }
+#endif
+
+    state->pc += Emulate8080(state);
+    instruction_count++;
+    return 1;
+}
+
+#if RECOMPILED
+#include "recompiled.c"
+#endif
+
+// Runs as much recompiled (or threaded) code as possible from PC when it's
+// built in, falls back to MachineStep for anything it doesn't cover. Those
+// cores don't stop for the HLE hooks or the idiom loops, so -hle is refused
+// and IDIOM_LOOPS is off in their builds
+int MachineRun(State8080 *state)
+{
+#if RECOMPILED
+    int ran = RunRecompiled(state, cycle_deadline);
+    if (ran)
+    {
+        dispatch_count++;
+        instruction_count += ran;
+        return ran;
+    }
+#elif THREADED_CORE
+    int ran = RunThreaded(state, cycle_deadline);
+    if (ran)
+    {
+        dispatch_count++;
+        instruction_count += ran;
+        return ran;
+    }
+#endif
+
+    return MachineStep(state);
+}
+
+// Runs one video frame worth of cycles, with the mid-screen (RST 1)
+// and VBlank (RST 2) interrupts at the half and at the end
+void MachineRunFrame(State8080 *state)
+{
+    uint64_t frame_start = state->cycles;
+
+    cycle_deadline = frame_start + CYCLES_PER_FRAME / 2;
+    while (state->cycles - frame_start < CYCLES_PER_FRAME / 2)
+    {
+        MachineRun(state);
+    }
+
+    if (state->int_enabled)
+    {
+        Interrupt(state, 1);
+    }
+
+    cycle_deadline = frame_start + CYCLES_PER_FRAME;
+    while (state->cycles - frame_start < CYCLES_PER_FRAME)
+    {
+        MachineRun(state);
+    }
+    // no interrupt to stop at until the next frame sets one
+    cycle_deadline = 0;
+
+    MachineVBlank(state);
+    if (state->int_enabled)
+    {
+        Interrupt(state, 2);
+    }
+}
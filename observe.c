@@ -0,0 +1,198 @@
+// Observations for the RL environment (env.c): the 1 bit per pixel video RAM
+// straight to a small grayscale image, without drawing the full frame first.
+//
+// The screen is 224 x 256 once rotated: video RAM column x (32 bytes) is screen
+// column x, and its bit y (bit y & 7 of byte y >> 3) is screen row 255 - y.
+// An output pixel is the average of a box of screen pixels. For a given output
+// row the box is a run of at most 57 consecutive bits in each column, so each
+// column of the box is one 64 bit load, a shift, a mask and a popcount.
+// Max-pooling over two frames is an OR of the two before counting, a pixel
+// being lit in either frame.
+//
+// ObserveStack is the frame stack: a ring of the last depth observations,
+// written in place, the oldest slot being reused for the next one.
+
+#define OBSERVE_COLUMNS 224
+#define OBSERVE_ROWS 256
+#define OBSERVE_COLUMN_BYTES 32
+
+typedef struct Observe
+{
+    int width;
+    int height;
+
+    // per output row: byte of the column to load from, shift and mask of its bits
+    uint8_t row_byte[OBSERVE_ROWS];
+    uint8_t row_shift[OBSERVE_ROWS];
+    uint64_t row_mask[OBSERVE_ROWS];
+    uint8_t row_pixels[OBSERVE_ROWS];
+
+    // per output column: first screen column and how many
+    uint8_t column_first[OBSERVE_COLUMNS];
+    uint8_t column_pixels[OBSERVE_COLUMNS];
+} Observe;
+
+typedef struct ObserveStack
+{
+    int depth;
+    int size; // bytes per observation
+    int head; // slot of the newest one
+    uint8_t *frames;
+} ObserveStack;
+
+// Sets up width x height observations (84 x 84 is the usual one).
+// Returns FALSE if the size isn't supported: up to 224 x 256, and at least
+// 5 rows so a box is never more than 57 bits high
+int ObserveInit(Observe *observe, int width, int height)
+{
+    int i;
+
+    if (width < 1 || width > OBSERVE_COLUMNS || height < 5 || height > OBSERVE_ROWS)
+    {
+        return FALSE;
+    }
+
+    observe->width = width;
+    observe->height = height;
+
+    for (i = 0; i < width; i++)
+    {
+        int first = i * OBSERVE_COLUMNS / width;
+        int last = (i + 1) * OBSERVE_COLUMNS / width;
+
+        observe->column_first[i] = first;
+        observe->column_pixels[i] = last - first;
+    }
+
+    for (i = 0; i < height; i++)
+    {
+        // screen rows [top, bottom) are bits [256 - bottom, 256 - top)
+        int top = i * OBSERVE_ROWS / height;
+        int bottom = (i + 1) * OBSERVE_ROWS / height;
+        int bit = OBSERVE_ROWS - bottom;
+        int pixels = bottom - top;
+
+        // the last 8 bytes of the column at most, so the load stays inside it
+        int byte = bit >> 3;
+        if (byte > OBSERVE_COLUMN_BYTES - 8)
+        {
+            byte = OBSERVE_COLUMN_BYTES - 8;
+        }
+
+        observe->row_byte[i] = byte;
+        observe->row_shift[i] = bit - byte * 8;
+        observe->row_mask[i] = (1ULL << pixels) - 1;
+        observe->row_pixels[i] = pixels;
+    }
+
+    return TRUE;
+}
+
+// 8 bytes of video RAM as a little endian 64 bit word (bit y is pixel y)
+static inline uint64_t ObserveLoad(const uint8_t *bytes)
+{
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+// bits set in a word, without a call into libgcc when the compiler can't assume POPCNT
+static inline int ObservePopcount(uint64_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+}
+
+// Lit pixels in each box of output column i, max-pooled with previous if given
+static inline void ObserveCount(Observe *observe, const uint8_t *vram, const uint8_t *previous, int i, uint16_t *counts)
+{
+    int x, row;
+
+    for (row = 0; row < observe->height; row++)
+    {
+        counts[row] = 0;
+    }
+
+    for (x = observe->column_first[i]; x < observe->column_first[i] + observe->column_pixels[i]; x++)
+    {
+        const uint8_t *column = vram + x * OBSERVE_COLUMN_BYTES;
+
+        if (previous)
+        {
+            const uint8_t *previous_column = previous + x * OBSERVE_COLUMN_BYTES;
+            for (row = 0; row < observe->height; row++)
+            {
+                uint64_t bits = ObserveLoad(column + observe->row_byte[row]) | ObserveLoad(previous_column + observe->row_byte[row]);
+                counts[row] += ObservePopcount((bits >> observe->row_shift[row]) & observe->row_mask[row]);
+            }
+        }
+        else
+        {
+            for (row = 0; row < observe->height; row++)
+            {
+                uint64_t bits = ObserveLoad(column + observe->row_byte[row]);
+                counts[row] += ObservePopcount((bits >> observe->row_shift[row]) & observe->row_mask[row]);
+            }
+        }
+    }
+}
+
+// width x height bytes, row by row, 0 (all dark) to 255 (all lit).
+// previous is the video RAM of the frame before, or NULL for no max-pooling
+void ObserveGray(Observe *observe, const uint8_t *vram, const uint8_t *previous, uint8_t *out)
+{
+    uint16_t counts[OBSERVE_ROWS];
+    int i, row;
+
+    for (i = 0; i < observe->width; i++)
+    {
+        ObserveCount(observe, vram, previous, i, counts);
+
+        for (row = 0; row < observe->height; row++)
+        {
+            int area = observe->column_pixels[i] * observe->row_pixels[row];
+            out[row * observe->width + i] = (counts[row] * 255 + area / 2) / area;
+        }
+    }
+}
+
+// same thing as floats from 0 to 1
+void ObserveGrayFloat(Observe *observe, const uint8_t *vram, const uint8_t *previous, float *out)
+{
+    uint16_t counts[OBSERVE_ROWS];
+    int i, row;
+
+    for (i = 0; i < observe->width; i++)
+    {
+        ObserveCount(observe, vram, previous, i, counts);
+
+        for (row = 0; row < observe->height; row++)
+        {
+            out[row * observe->width + i] = (float)counts[row] / (observe->column_pixels[i] * observe->row_pixels[row]);
+        }
+    }
+}
+
+// A ring of depth observations of size bytes each, in frames (depth * size bytes)
+void ObserveStackInit(ObserveStack *stack, uint8_t *frames, int depth, int size)
+{
+    stack->depth = depth;
+    stack->size = size;
+    stack->head = 0;
+    stack->frames = frames;
+}
+
+// The slot for the next observation, which becomes the newest one
+uint8_t *ObserveStackPush(ObserveStack *stack)
+{
+    stack->head = (stack->head + 1) % stack->depth;
+    return stack->frames + stack->head * stack->size;
+}
+
+// age 0 is the newest observation, depth - 1 the oldest
+uint8_t *ObserveStackFrame(ObserveStack *stack, int age)
+{
+    return stack->frames + ((stack->head - age + stack->depth) % stack->depth) * stack->size;
+}
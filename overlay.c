@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <string.h>
+
+// The cabinet's color overlay: the monitor is black and white, the colors come
+// from gel strips stuck on the glass (red near the top, green at the bottom).
+// For the conversion to pixels, it's the color of a lit pixel in each row of
+// each column; columns that have the same strips share the same table of row
+// colors, so drawing with the overlay is a table lookup per pixel where white
+// would be a constant.
+//
+// Layouts are text files (assets/overlay.txt), one strip per line, later ones
+// over earlier ones, rows and columns of the screen as it's shown (0, 0 at the
+// top left), color as RRGGBB:
+//
+//   # top row, bottom row, left column, right column, color
+//   32 63 0 223 ff2020
+
+#define OVERLAY_TABLES 16
+#define OVERLAY_WHITE 0xffffffff
+
+typedef struct Overlay
+{
+    uint32_t table[OVERLAY_TABLES][VIDEO_HEIGHT];
+    int tables;
+    const uint32_t *column[VIDEO_WIDTH];
+} Overlay;
+
+void OverlayMonochrome(Overlay *overlay)
+{
+    int x, y;
+
+    for (y = 0; y < VIDEO_HEIGHT; y++)
+    {
+        overlay->table[0][y] = OVERLAY_WHITE;
+    }
+    overlay->tables = 1;
+    for (x = 0; x < VIDEO_WIDTH; x++)
+    {
+        overlay->column[x] = overlay->table[0];
+    }
+}
+
+// Reads a layout. Returns FALSE (and leaves overlay monochrome) if the file
+// can't be read, has a bad line, or more different columns than there are tables
+int OverlayLoad(Overlay *overlay, const char *path)
+{
+    static uint32_t colors[VIDEO_WIDTH][VIDEO_HEIGHT];
+    FILE *fp = fopen(path, "r");
+    char line[256];
+    int x, y, i;
+
+    OverlayMonochrome(overlay);
+    if (fp == NULL)
+    {
+        return FALSE;
+    }
+
+    for (x = 0; x < VIDEO_WIDTH; x++)
+    {
+        for (y = 0; y < VIDEO_HEIGHT; y++)
+        {
+            colors[x][y] = OVERLAY_WHITE;
+        }
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        int top, bottom, left, right;
+        unsigned int rgb;
+        char *start = line + strspn(line, " \t");
+
+        if (*start == '#' || *start == '\n' || *start == '\r' || *start == 0)
+        {
+            continue;
+        }
+        if (sscanf(start, "%d %d %d %d %x", &top, &bottom, &left, &right, &rgb) != 5 || top < 0 || left < 0 ||
+            bottom >= VIDEO_HEIGHT || right >= VIDEO_WIDTH)
+        {
+            printf("error: Bad overlay line in %s: %s", path, line);
+            fclose(fp);
+            return FALSE;
+        }
+
+        for (x = left; x <= right; x++)
+        {
+            for (y = top; y <= bottom; y++)
+            {
+                colors[x][y] = 0xff000000 | rgb;
+            }
+        }
+    }
+    fclose(fp);
+
+    // the conversion goes up from the bottom of the screen, so do the tables
+    overlay->tables = 0;
+    for (x = 0; x < VIDEO_WIDTH; x++)
+    {
+        uint32_t column[VIDEO_HEIGHT];
+
+        for (y = 0; y < VIDEO_HEIGHT; y++)
+        {
+            column[y] = colors[x][VIDEO_HEIGHT - 1 - y];
+        }
+        for (i = 0; i < overlay->tables; i++)
+        {
+            if (memcmp(overlay->table[i], column, sizeof(column)) == 0)
+            {
+                break;
+            }
+        }
+        if (i == overlay->tables)
+        {
+            if (i == OVERLAY_TABLES)
+            {
+                printf("error: More than %d different columns in overlay %s\n", OVERLAY_TABLES, path);
+                OverlayMonochrome(overlay);
+                return FALSE;
+            }
+            memcpy(overlay->table[i], column, sizeof(column));
+            overlay->tables++;
+        }
+        overlay->column[x] = overlay->table[i];
+    }
+    return TRUE;
+}
@@ -0,0 +1,156 @@
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Speed governor: holds the machine to real time from its cycle count.
+// Cycle n is due at start + n / CPU_HZ on the host's monotonic clock, so
+// nothing drifts over time however the waits go. A wait sleeps for most of
+// the time left and spins for the last stretch; the stretch is as long as the
+// worst oversleep seen lately, so it's short where sleeping is precise and
+// longer where it isn't (Windows timer ticks, SDL asks for 1 ms ones).
+//
+//   Pacer pacer;
+//   PacerInit(&pacer, state->cycles);
+//   ... run a frame ...
+//   PacerWait(&pacer, state->cycles);
+
+// don't spin for less than this, nor more than that
+#define PACER_MIN_SPIN_NS 200000
+#define PACER_MAX_SPIN_NS 4000000
+
+// further behind than this, give up on catching up and start again from now
+#define PACER_RESYNC_NS 100000000
+
+typedef struct Pacer
+{
+    long long start_ns;
+    unsigned int start_cycles;
+    long long spin_ns;
+
+    // stats: lateness of each wait (when it returned vs. when it should have),
+    // its change from one wait to the next (jitter), the drift at the last
+    // one, and where the waiting time went
+    unsigned long long waits;
+    unsigned long long resyncs;
+    double late_total;
+    double jitter_total;
+    long long late_max;
+    long long drift_ns;
+    long long slept_ns;
+    long long spun_ns;
+} Pacer;
+
+long long PacerNow()
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (long long)((double)counter.QuadPart * 1e9 / frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+#endif
+}
+
+void PacerSleep(long long ns)
+{
+#ifdef _WIN32
+    Sleep((DWORD)(ns / 1000000));
+#else
+    struct timespec time = {ns / 1000000000LL, ns % 1000000000LL};
+    nanosleep(&time, NULL);
+#endif
+}
+
+void PacerInit(Pacer *pacer, unsigned int cycles)
+{
+    memset(pacer, 0, sizeof(Pacer));
+    pacer->start_ns = PacerNow();
+    pacer->start_cycles = cycles;
+    pacer->spin_ns = PACER_MIN_SPIN_NS;
+}
+
+// Waits until the host clock reaches the time of cycles
+void PacerWait(Pacer *pacer, unsigned int cycles)
+{
+    long long due = pacer->start_ns + (long long)((cycles - pacer->start_cycles) * 1e9 / CPU_HZ);
+    long long now = PacerNow();
+
+    if (now - due > PACER_RESYNC_NS)
+    {
+        // a breakpoint, a dragged window... not worth running flat out to catch up
+        pacer->resyncs++;
+        pacer->start_ns = now;
+        pacer->start_cycles = cycles;
+        return;
+    }
+
+    // sleep most of it
+    if (due - now > pacer->spin_ns)
+    {
+        long long asked = due - now - pacer->spin_ns;
+        long long before = now;
+
+        PacerSleep(asked);
+        now = PacerNow();
+        pacer->slept_ns += now - before;
+
+        // spin for as long as sleeping can overshoot, slowly forgetting old overshoots
+        long long overslept = (now - before) - asked;
+        pacer->spin_ns -= pacer->spin_ns / 64;
+        if (overslept > pacer->spin_ns)
+        {
+            pacer->spin_ns = overslept;
+        }
+        if (pacer->spin_ns < PACER_MIN_SPIN_NS)
+        {
+            pacer->spin_ns = PACER_MIN_SPIN_NS;
+        }
+        if (pacer->spin_ns > PACER_MAX_SPIN_NS)
+        {
+            pacer->spin_ns = PACER_MAX_SPIN_NS;
+        }
+    }
+
+    // and spin the rest
+    long long spin_start = now;
+    while (now < due)
+    {
+        now = PacerNow();
+    }
+    pacer->spun_ns += now - spin_start;
+
+    long long late = now - due;
+    if (pacer->waits)
+    {
+        pacer->jitter_total += llabs(late - pacer->drift_ns);
+    }
+    pacer->waits++;
+    pacer->late_total += late;
+    if (late > pacer->late_max)
+    {
+        pacer->late_max = late;
+    }
+    pacer->drift_ns = late;
+}
+
+void PacerReport(Pacer *pacer)
+{
+    if (pacer->waits == 0)
+    {
+        return;
+    }
+
+    double mean = pacer->late_total / pacer->waits;
+    double jitter = (pacer->waits > 1) ? pacer->jitter_total / (pacer->waits - 1) : 0;
+    double waited = pacer->slept_ns + pacer->spun_ns;
+
+    printf("Pacer: %llu waits, %llu resyncs, drift now %.1f us\n", pacer->waits, pacer->resyncs, pacer->drift_ns / 1e3);
+    printf("  late by %.1f us on average (jitter %.1f us, worst %.1f us)\n", mean / 1e3, jitter / 1e3, pacer->late_max / 1e3);
+    printf("  waiting: %.1f%% asleep, %.1f%% spinning (spin stretch now %.2f ms)\n",
+           waited ? 100 * pacer->slept_ns / waited : 0, waited ? 100 * pacer->spun_ns / waited : 0, pacer->spin_ns / 1e6);
+}
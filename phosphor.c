@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+
+// Phosphor persistence: on the real monitor a pixel that goes dark fades out
+// over a few frames instead of going black at once, which smooths over the
+// game's flicker (shots, explosions and the saucer are only drawn on some
+// frames). This keeps the glow of every pixel and each frame does, per color
+// channel,
+//
+//   glow = min(255, glow * decay + frame)
+//
+// so lit pixels are lit at once and dark ones fade by decay per frame. It works
+// on whatever ARGB frame it's given, 1x or out of a scaler (scale.c), so the
+// cost goes with the number of pixels: four pixels at a time with GCC's vector
+// extensions, as eight 16-bit lanes of the even bytes and eight of the odd
+// ones, so the multiply-add has room without unpacking anything.
+//
+//   Phosphor phosphor;
+//   PhosphorInit(&phosphor, width * height, 0.5);
+//   shown = PhosphorApply(&phosphor, frame);   // every frame
+
+typedef uint16_t PhosphorWords __attribute__((vector_size(16)));
+
+#define PHOSPHOR_BYTES (int)sizeof(PhosphorWords)
+
+typedef struct Phosphor
+{
+    uint32_t *glow;
+    int pixels;
+    uint16_t decay; // what's left after a frame, in 256ths
+} Phosphor;
+
+// Returns FALSE if the buffer couldn't be allocated
+int PhosphorInit(Phosphor *phosphor, int pixels, double decay)
+{
+    phosphor->pixels = pixels;
+    phosphor->decay = (decay <= 0) ? 0 : (decay >= 1) ? 256 : (uint16_t)(decay * 256);
+    phosphor->glow = (uint32_t *)calloc(pixels, sizeof(uint32_t));
+    return phosphor->glow != NULL;
+}
+
+void PhosphorRelease(Phosphor *phosphor)
+{
+    free(phosphor->glow);
+    phosphor->glow = NULL;
+}
+
+// sum is at most 255 + 255: anything over 255 has bit 8 set, which turns into
+// all ones, 255 once cut down to a byte
+static inline PhosphorWords PhosphorSaturate(PhosphorWords sum)
+{
+    return (sum | -(sum >> 8)) & 0xff;
+}
+
+// Adds frame (phosphor->pixels ARGB pixels, a multiple of four like any size
+// the screen comes in) to the fading glow and returns it, to show instead
+const uint32_t *PhosphorApply(Phosphor *phosphor, const uint32_t *frame)
+{
+    uint8_t *glow = (uint8_t *)phosphor->glow;
+    const uint8_t *in = (const uint8_t *)frame;
+    int bytes = phosphor->pixels * 4;
+    uint16_t decay = phosphor->decay;
+    int i;
+
+    for (i = 0; i < bytes; i += PHOSPHOR_BYTES)
+    {
+        PhosphorWords old, new;
+
+        memcpy(&old, glow + i, sizeof(old));
+        memcpy(&new, in + i, sizeof(new));
+
+        PhosphorWords even = PhosphorSaturate((((old & 0xff) * decay) >> 8) + (new & 0xff));
+        PhosphorWords odd = PhosphorSaturate((((old >> 8) * decay) >> 8) + (new >> 8));
+        PhosphorWords out = even | (odd << 8);
+
+        memcpy(glow + i, &out, sizeof(out));
+    }
+    return phosphor->glow;
+}
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// Dynamic opcode n-gram profiler.
+// Counts runs of 2 to 4 instructions executed back to back (each one starting
+// right where the previous one ended, so taken jumps break the run) and writes
+// the most frequent ones to fused_ops.h, which the FUSE_OPCODES build turns
+// into superinstructions (see fuse.c).
+
+#define PROFILE_MAX_LENGTH 4
+#define PROFILE_TABLE_SIZE (1 << 16)
+
+typedef struct NGram
+{
+    uint32_t ops; // opcodes packed one per byte, first opcode in the low byte
+    uint8_t length;
+    unsigned long long count;
+} NGram;
+
+NGram profile_table[PROFILE_TABLE_SIZE];
+unsigned long long opcode_counts[256];
+
+uint8_t profile_history[PROFILE_MAX_LENGTH];
+int profile_history_length = 0;
+uint16_t profile_next_pc = 0;
+
+void ProfileCount(uint32_t ops, uint8_t length)
+{
+    uint32_t i = ((ops * 2654435761u) ^ length) & (PROFILE_TABLE_SIZE - 1);
+
+    // open addressing, give up on the n-gram if the table is full
+    int probes;
+    for (probes = 0; probes < PROFILE_TABLE_SIZE; probes++)
+    {
+        NGram *entry = &profile_table[i];
+
+        if (entry->length == 0)
+        {
+            entry->ops = ops;
+            entry->length = length;
+        }
+
+        if (entry->ops == ops && entry->length == length)
+        {
+            entry->count++;
+            return;
+        }
+
+        i = (i + 1) & (PROFILE_TABLE_SIZE - 1);
+    }
+}
+
+void ProfileInstruction(uint16_t pc, uint8_t op)
+{
+    opcode_counts[op]++;
+
+    if (pc != profile_next_pc)
+    {
+        // jumped somewhere, start a new run
+        profile_history_length = 0;
+    }
+    profile_next_pc = pc + opcode_lengths[op];
+
+    if (profile_history_length == PROFILE_MAX_LENGTH)
+    {
+        int i;
+        for (i = 1; i < PROFILE_MAX_LENGTH; i++)
+        {
+            profile_history[i - 1] = profile_history[i];
+        }
+        profile_history_length--;
+    }
+    profile_history[profile_history_length++] = op;
+
+    // every run that ends with this instruction
+    int length;
+    for (length = 2; length <= profile_history_length; length++)
+    {
+        uint32_t ops = 0;
+        int i;
+        for (i = 0; i < length; i++)
+        {
+            ops |= profile_history[profile_history_length - length + i] << (8 * i);
+        }
+        ProfileCount(ops, length);
+    }
+}
+
+// dispatches saved if the whole n-gram runs as one
+unsigned long long ProfileSaved(const NGram *ngram)
+{
+    return ngram->count * (ngram->length - 1);
+}
+
+int CompareNGrams(const void *left, const void *right)
+{
+    unsigned long long l = ProfileSaved((const NGram *)left);
+    unsigned long long r = ProfileSaved((const NGram *)right);
+
+    if (l == r)
+    {
+        return 0;
+    }
+    return (l < r) ? 1 : -1;
+}
+
+int CompareLongestFirst(const void *left, const void *right)
+{
+    const NGram *l = (const NGram *)left;
+    const NGram *r = (const NGram *)right;
+
+    if (l->length != r->length)
+    {
+        return r->length - l->length;
+    }
+    return CompareNGrams(left, right);
+}
+
+void PrintNGram(FILE *out, const NGram *ngram)
+{
+    int i;
+    for (i = 0; i < ngram->length; i++)
+    {
+        fprintf(out, "%s0x%02x", (i == 0) ? "" : ", ", (ngram->ops >> (8 * i)) & 0xff);
+    }
+}
+
+// Prints the top n-grams and writes the best top_n fusible ones to fused_path
+void ProfileReport(int top_n, const char *fused_path)
+{
+    NGram *sorted = (NGram *)malloc(sizeof(NGram) * PROFILE_TABLE_SIZE);
+    int used = 0;
+    int i;
+
+    unsigned long long total = 0;
+    for (i = 0; i < 256; i++)
+    {
+        total += opcode_counts[i];
+    }
+
+    for (i = 0; i < PROFILE_TABLE_SIZE; i++)
+    {
+        if (profile_table[i].length != 0)
+        {
+            sorted[used++] = profile_table[i];
+        }
+    }
+    qsort(sorted, used, sizeof(NGram), CompareNGrams);
+
+    int length;
+    for (length = 2; length <= PROFILE_MAX_LENGTH; length++)
+    {
+        printf("\nTop %d-grams (%llu instructions profiled)\n", length, total);
+
+        int shown = 0;
+        for (i = 0; i < used && shown < 10; i++)
+        {
+            if (sorted[i].length != length)
+            {
+                continue;
+            }
+            printf("%12llu  %5.2f%%  ", sorted[i].count, 100.0 * sorted[i].count / total);
+            PrintNGram(stdout, &sorted[i]);
+            printf("\n");
+            shown++;
+        }
+    }
+
+    // keep the best ones, then order them longest first
+    // so the dispatcher tries the longest match first
+    int picked = used < top_n ? used : top_n;
+    qsort(sorted, picked, sizeof(NGram), CompareLongestFirst);
+
+    FILE *fp = fopen(fused_path, "w");
+    if (fp == NULL)
+    {
+        printf("error: Couldn't open %s\n", fused_path);
+        free(sorted);
+        return;
+    }
+
+    fprintf(fp, "// generated by the PROFILE_OPCODES build of headless.c, do not edit\n");
+    fprintf(fp, "// FUSEn(opcodes...) // times seen, dispatches saved\n");
+    for (i = 0; i < picked; i++)
+    {
+        fprintf(fp, "FUSE%d(", sorted[i].length);
+        PrintNGram(fp, &sorted[i]);
+        fprintf(fp, ") // %llu, %llu\n", sorted[i].count, ProfileSaved(&sorted[i]));
+    }
+    fclose(fp);
+
+    // overlapping n-grams share instructions, so the real reduction has to be
+    // measured with the FUSE_OPCODES build
+    printf("\nWrote %d sequences to %s\n", picked, fused_path);
+
+    free(sorted);
+}
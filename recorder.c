@@ -0,0 +1,230 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+// Records the frames to a Y4M file (YUV4MPEG2, raw video that ffmpeg, x264 and
+// the like read as is), without a screen:
+//
+//   ffmpeg -i run.y4m -vf scale=448:512:flags=neighbor run.mp4
+//
+// The emulation side only copies the 7 KB of video RAM into a ring of slots
+// and goes on, a writer thread turns it into pixels and writes it. Black and
+// white, that's a gray plane (Cmono, 0 or 255); with an overlay it's the
+// colors as Y, Cb and Cr planes at full resolution (C444). In real time
+// nothing on the emulation side ever waits for the disk: if the ring is full
+// the frame is dropped and the writer puts the previous one in its place, so
+// the video keeps the game's timing, and the drops are counted. A run that
+// isn't real time opens it lossless instead and waits for a free slot, it's
+// only the emulation that gets slower.
+//
+//   Recorder recorder;
+//   RecorderOpen(&recorder, "run.y4m", NULL, FALSE);
+//   RecorderFrame(&recorder, state->memory + 0x2400);   // every frame
+//   RecorderClose(&recorder);
+
+// about half a second of frames
+#define RECORDER_SLOTS 32
+
+typedef struct RecorderSlot
+{
+    int repeats; // dropped before this one, the previous frame is written again for them
+    uint8_t vram[0x1c00];
+} RecorderSlot;
+
+typedef struct Recorder
+{
+    FILE *fp;
+    pthread_t thread;
+    sem_t ready; // a post per frame put in the ring
+    sem_t free_slots; // a post per frame taken out of it
+    RecorderSlot slots[RECORDER_SLOTS];
+    _Atomic unsigned int head; // frames put in, emulation side
+    _Atomic unsigned int tail; // frames written, writer side
+    atomic_int closing;
+    int lossless; // wait for a free slot instead of dropping
+    int dropped_since; // emulation side, for the next slot's repeats
+    long frames;
+    long dropped;
+
+    // writer side
+    Overlay colors; // unused in black and white
+    uint32_t pixels[VIDEO_WIDTH * VIDEO_HEIGHT];
+    uint8_t planes[3][VIDEO_WIDTH * VIDEO_HEIGHT];
+    int plane_count;
+    int written; // a frame is in planes
+} Recorder;
+
+// BT.601 with the usual 16-235 range, for the encoders that take Y4M
+static void RecorderYuv(uint32_t argb, uint8_t *y, uint8_t *cb, uint8_t *cr)
+{
+    int r = (argb >> 16) & 0xff, g = (argb >> 8) & 0xff, b = argb & 0xff;
+
+    *y = (uint8_t)(16 + ((66 * r + 129 * g + 25 * b + 128) >> 8));
+    *cb = (uint8_t)(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+    *cr = (uint8_t)(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+}
+
+static void RecorderConvert(Recorder *recorder, const uint8_t *vram)
+{
+    int i, x, y;
+
+    if (recorder->plane_count == 1)
+    {
+        // straight from the bits, lit pixels are 255 and the rest 0, the
+        // right way up like VideoDrawColumn
+        for (x = 0; x < VIDEO_WIDTH; x++)
+        {
+            const uint8_t *column = vram + x * 32;
+            uint8_t *out = recorder->planes[0] + (VIDEO_HEIGHT - 1) * VIDEO_WIDTH + x;
+
+            for (y = 0; y < VIDEO_HEIGHT; y++, out -= VIDEO_WIDTH)
+            {
+                *out = -((column[y >> 3] >> (y & 7)) & 1);
+            }
+        }
+        return;
+    }
+
+    VideoDraw(vram, recorder->pixels, &recorder->colors);
+    for (i = 0; i < VIDEO_WIDTH * VIDEO_HEIGHT; i++)
+    {
+        RecorderYuv(recorder->pixels[i], &recorder->planes[0][i], &recorder->planes[1][i], &recorder->planes[2][i]);
+    }
+}
+
+static void RecorderWrite(Recorder *recorder)
+{
+    int plane;
+
+    fputs("FRAME\n", recorder->fp);
+    for (plane = 0; plane < recorder->plane_count; plane++)
+    {
+        fwrite(recorder->planes[plane], VIDEO_WIDTH * VIDEO_HEIGHT, 1, recorder->fp);
+    }
+}
+
+static void RecorderRepeat(Recorder *recorder, int repeats)
+{
+    // nothing to repeat before the first frame
+    while (recorder->written && repeats-- > 0)
+    {
+        RecorderWrite(recorder);
+    }
+}
+
+static void *RecorderThread(void *arg)
+{
+    Recorder *recorder = (Recorder *)arg;
+
+    for (;;)
+    {
+        sem_wait(&recorder->ready);
+
+        unsigned int tail = atomic_load_explicit(&recorder->tail, memory_order_relaxed);
+        if (tail == atomic_load_explicit(&recorder->head, memory_order_acquire))
+        {
+            // only RecorderClose posts without a frame
+            if (atomic_load(&recorder->closing))
+            {
+                return NULL;
+            }
+            continue;
+        }
+
+        RecorderSlot *slot = &recorder->slots[tail % RECORDER_SLOTS];
+        RecorderRepeat(recorder, slot->repeats);
+        RecorderConvert(recorder, slot->vram);
+        atomic_store_explicit(&recorder->tail, tail + 1, memory_order_release);
+        sem_post(&recorder->free_slots);
+
+        RecorderWrite(recorder);
+        recorder->written = TRUE;
+    }
+}
+
+// Starts writing to path, in the colors of overlay or in black and white if
+// it's NULL, lossless or dropping frames when the writer is behind. Returns
+// FALSE if the file or the thread couldn't be made
+int RecorderOpen(Recorder *recorder, const char *path, const Overlay *overlay, int lossless)
+{
+    recorder->fp = fopen(path, "wb");
+    if (recorder->fp == NULL)
+    {
+        return FALSE;
+    }
+
+    recorder->plane_count = 1;
+    if (overlay)
+    {
+        recorder->colors = *overlay;
+        recorder->plane_count = 3;
+    }
+
+    // 59.54 frames per second; ffmpeg reads the range from XCOLORRANGE
+    fprintf(recorder->fp, "YUV4MPEG2 W%d H%d F2977:50 Ip A1:1 %s\n", VIDEO_WIDTH, VIDEO_HEIGHT,
+            overlay ? "C444 XCOLORRANGE=LIMITED" : "Cmono XCOLORRANGE=FULL");
+
+    atomic_store(&recorder->head, 0);
+    atomic_store(&recorder->tail, 0);
+    atomic_store(&recorder->closing, FALSE);
+    recorder->dropped_since = 0;
+    recorder->frames = 0;
+    recorder->dropped = 0;
+    recorder->written = FALSE;
+    recorder->lossless = lossless;
+
+    sem_init(&recorder->ready, 0, 0);
+    sem_init(&recorder->free_slots, 0, RECORDER_SLOTS);
+    if (pthread_create(&recorder->thread, NULL, RecorderThread, recorder) != 0)
+    {
+        sem_destroy(&recorder->ready);
+        sem_destroy(&recorder->free_slots);
+        fclose(recorder->fp);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Queues the frame in vram, emulation side. If the writer is a whole ring
+// behind, a lossless recorder waits for it and the other drops the frame
+void RecorderFrame(Recorder *recorder, const uint8_t *vram)
+{
+    unsigned int head = atomic_load_explicit(&recorder->head, memory_order_relaxed);
+
+    recorder->frames++;
+    if (recorder->lossless)
+    {
+        sem_wait(&recorder->free_slots);
+    }
+    else if (sem_trywait(&recorder->free_slots) != 0)
+    {
+        recorder->dropped_since++;
+        recorder->dropped++;
+        return;
+    }
+
+    RecorderSlot *slot = &recorder->slots[head % RECORDER_SLOTS];
+    slot->repeats = recorder->dropped_since;
+    memcpy(slot->vram, vram, sizeof(slot->vram));
+    recorder->dropped_since = 0;
+
+    atomic_store_explicit(&recorder->head, head + 1, memory_order_release);
+    sem_post(&recorder->ready);
+}
+
+// Waits for the writer to catch up and closes the file
+void RecorderClose(Recorder *recorder)
+{
+    atomic_store(&recorder->closing, TRUE);
+    sem_post(&recorder->ready);
+    pthread_join(recorder->thread, NULL);
+
+    // frames dropped after the last one queued
+    RecorderRepeat(recorder, recorder->dropped_since);
+
+    sem_destroy(&recorder->ready);
+    sem_destroy(&recorder->free_slots);
+    fclose(recorder->fp);
+}
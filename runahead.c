@@ -0,0 +1,75 @@
+// Run-ahead: the game takes a frame or two to show what the player pressed.
+// Each frame, after running the real one, the machine is saved, runs N more
+// frames with the same input, and what's on its screen then is what gets
+// shown; then it goes back to the save. The player sees the frame the game
+// would show N frames later if the input stays as it is, so the game's own lag
+// is hidden as long as N isn't more than it. Costs N + 1 frames of emulation
+// per frame shown (plus a save and a load, see savestate.c).
+//
+//   RunAhead ahead = {2};
+//   vram = RunAheadFrame(&ahead, state);   // instead of MachineRunFrame
+
+// more than that is never useful, the game reacts within a few frames
+#define RUNAHEAD_MAX_FRAMES 8
+
+typedef struct RunAhead
+{
+    int frames; // N, 0 for off
+    SaveState save;
+    uint8_t vram[0x1c00]; // the frame N frames ahead
+} RunAhead;
+
+// Runs a frame of the machine. Returns the video RAM to show: the machine's
+// own, or the one N frames ahead
+const uint8_t *RunAheadFrame(RunAhead *ahead, State8080 *state)
+{
+    int frame, column;
+
+    MachineRunFrame(state);
+    if (ahead->frames <= 0)
+    {
+        return state->memory + 0x2400;
+    }
+
+    SaveMachine(&ahead->save, state);
+
+    // writes that are going to be undone don't get reported either; what
+    // changed on screen is reported below instead
+    void (*write_hook)(struct State8080 *, uint16_t, uint16_t) = state->write_hook;
+    state->write_hook = NULL;
+
+    // nor heard
+    MachineDevice *device = MachineDeviceOf(state);
+    Sound *sound = device->sound;
+    device->sound = NULL;
+
+#if SHARED_EXPORT
+    // frames that are going to be thrown away don't get published
+    ExportRegion *export = export_region;
+    export_region = NULL;
+#endif
+
+    for (frame = 0; frame < ahead->frames && frame < RUNAHEAD_MAX_FRAMES; frame++)
+    {
+        MachineRunFrame(state);
+    }
+
+#if SHARED_EXPORT
+    export_region = export;
+#endif
+    device->sound = sound;
+
+    // the columns that differ from the frame shown last time
+    for (column = 0; write_hook && column < 0x1c00; column += 32)
+    {
+        if (memcmp(ahead->vram + column, state->memory + 0x2400 + column, 32) != 0)
+        {
+            write_hook(state, 0x2400 + column, 32);
+        }
+    }
+
+    memcpy(ahead->vram, state->memory + 0x2400, sizeof(ahead->vram));
+    LoadMachine(&ahead->save, state);
+    state->write_hook = write_hook;
+    return ahead->vram;
+}
@@ -0,0 +1,42 @@
+#include <string.h>
+
+// Save states: the whole machine at some point (registers, memory, shift
+// register and port latches), to go back to it later. A save is a plain copy
+// into a buffer the caller owns, about 64 KB, so taking one and going back to
+// it costs a few microseconds and can be done every frame (see runahead.c).
+
+typedef struct SaveState
+{
+    State8080 state; // memory not included, it's below
+    MachineDevice device;
+    uint8_t memory[ADDRESS_SPACE];
+} SaveState;
+
+void SaveMachine(SaveState *save, State8080 *state)
+{
+    save->state = *state;
+    save->state.memory = NULL;
+    save->device = *MachineDeviceOf(state);
+    memcpy(save->memory, state->memory, ADDRESS_SPACE);
+}
+
+// Puts state back as it was saved. Its memory, write hook, ports, device and
+// sound stay its own (the device gets the saved contents), and the hook isn't
+// told about the memory put back
+void LoadMachine(SaveState *save, State8080 *state)
+{
+    uint8_t *memory = state->memory;
+    void (*write_hook)(struct State8080 *, uint16_t, uint16_t) = state->write_hook;
+    const PortTable *ports = state->ports;
+    MachineDevice *device = MachineDeviceOf(state);
+    Sound *sound = device->sound;
+
+    *state = save->state;
+    state->memory = memory;
+    state->write_hook = write_hook;
+    state->ports = ports;
+    state->device = device;
+    *device = save->device;
+    device->sound = sound;
+    memcpy(state->memory, save->memory, ADDRESS_SPACE);
+}
@@ -0,0 +1,238 @@
+// Software scalers for the VIDEO_WIDTH x VIDEO_HEIGHT ARGB frame, so that a big
+// window or a video dump looks the same whatever the GPU does when stretching:
+// integer nearest neighbour (2x, 3x) and Scale2x/Scale3x (EPX), which round
+// off the staircase on diagonals without blurring anything.
+//
+// A scaler works on a range of source columns and writes the corresponding
+// columns of the output (factor times as wide and as high), so it can redo just
+// the columns that changed (video.c): Scale2x/3x look at the neighbours, so a
+// changed column changes the output of the ones on each side too (ScaleWiden).
+// The inner loops go over padded copies of three source rows with no edge
+// cases, four pixels at a time, picking pixels with vector compares and masks
+// instead of branches.
+//
+//   const Scaler *scaler = ScalerFind("scale2x");
+//   scaler->run(pixels, scaled, 0, VIDEO_WIDTH);
+
+typedef struct Scaler
+{
+    const char *name;
+    int factor;
+    void (*run)(const uint32_t *source, uint32_t *out, int first, int last); // columns first to last - 1
+} Scaler;
+
+// Four pixels at a time with GCC's vector extensions (SSE2 on x86, NEON on
+// ARM). Comparisons give all ones or all zeros per pixel, so choosing between
+// two pixels is an AND-OR with the mask
+typedef uint32_t ScaleVector __attribute__((vector_size(16)));
+typedef int32_t ScaleMask __attribute__((vector_size(16)));
+
+#define SCALE_LANES 4
+
+static inline ScaleVector ScaleLoad(const uint32_t *pixels)
+{
+    ScaleVector vector;
+    memcpy(&vector, pixels, sizeof(vector));
+    return vector;
+}
+
+static inline void ScaleStore(uint32_t *pixels, ScaleVector vector)
+{
+    memcpy(pixels, &vector, sizeof(vector));
+}
+
+static inline ScaleVector ScaleSelect(ScaleMask mask, ScaleVector yes, ScaleVector no)
+{
+    return (yes & (ScaleVector)mask) | (no & ~(ScaleVector)mask);
+}
+
+// pixels of a, b, c one after the other: a0 b0 c0 a1 b1 c1...
+static inline void ScaleStore3(uint32_t *pixels, ScaleVector a, ScaleVector b, ScaleVector c)
+{
+    ScaleVector ab0 = __builtin_shuffle(a, b, (ScaleMask){0, 4, 0, 1});
+    ScaleVector ab1 = __builtin_shuffle(a, b, (ScaleMask){5, 0, 2, 6});
+    ScaleVector ab2 = __builtin_shuffle(a, b, (ScaleMask){0, 3, 7, 0});
+
+    ScaleStore(pixels, __builtin_shuffle(ab0, c, (ScaleMask){0, 1, 4, 3}));
+    ScaleStore(pixels + 4, __builtin_shuffle(ab1, c, (ScaleMask){0, 5, 2, 3}));
+    ScaleStore(pixels + 8, __builtin_shuffle(ab2, c, (ScaleMask){6, 1, 2, 7}));
+}
+
+// The columns out to whole vectors (VIDEO_WIDTH is a multiple of them), doing a
+// few more than asked costs less than doing the odd ones one at a time
+static inline void ScaleAlign(int *first, int *last)
+{
+    *first &= ~(SCALE_LANES - 1);
+    *last = (*last + SCALE_LANES - 1) & ~(SCALE_LANES - 1);
+}
+
+// source row y with one more pixel on each side, copies of the edge ones
+static inline void ScaleRow(const uint32_t *source, int y, int first, int last, uint32_t *row)
+{
+    if (y < 0)
+    {
+        y = 0;
+    }
+    if (y >= VIDEO_HEIGHT)
+    {
+        y = VIDEO_HEIGHT - 1;
+    }
+    source += y * VIDEO_WIDTH;
+
+    row[first] = source[first > 0 ? first - 1 : 0];
+    memcpy(row + first + 1, source + first, (last - first) * sizeof(uint32_t));
+    row[last + 1] = source[last < VIDEO_WIDTH ? last : VIDEO_WIDTH - 1];
+}
+
+void ScaleNearest2(const uint32_t *source, uint32_t *out, int first, int last)
+{
+    int x, y;
+
+    ScaleAlign(&first, &last);
+    for (y = 0; y < VIDEO_HEIGHT; y++)
+    {
+        const uint32_t *in = source + y * VIDEO_WIDTH;
+        uint32_t *top = out + (2 * y) * (2 * VIDEO_WIDTH);
+
+        for (x = first; x < last; x += SCALE_LANES)
+        {
+            ScaleVector e = ScaleLoad(in + x);
+
+            ScaleStore(top + 2 * x, __builtin_shuffle(e, (ScaleMask){0, 0, 1, 1}));
+            ScaleStore(top + 2 * x + 4, __builtin_shuffle(e, (ScaleMask){2, 2, 3, 3}));
+        }
+        memcpy(top + 2 * VIDEO_WIDTH + 2 * first, top + 2 * first, 2 * (last - first) * sizeof(uint32_t));
+    }
+}
+
+void ScaleNearest3(const uint32_t *source, uint32_t *out, int first, int last)
+{
+    int x, y;
+
+    ScaleAlign(&first, &last);
+    for (y = 0; y < VIDEO_HEIGHT; y++)
+    {
+        const uint32_t *in = source + y * VIDEO_WIDTH;
+        uint32_t *top = out + (3 * y) * (3 * VIDEO_WIDTH);
+
+        for (x = first; x < last; x += SCALE_LANES)
+        {
+            ScaleVector e = ScaleLoad(in + x);
+
+            ScaleStore3(top + 3 * x, e, e, e);
+        }
+        memcpy(top + 3 * VIDEO_WIDTH + 3 * first, top + 3 * first, 3 * (last - first) * sizeof(uint32_t));
+        memcpy(top + 6 * VIDEO_WIDTH + 3 * first, top + 3 * first, 3 * (last - first) * sizeof(uint32_t));
+    }
+}
+
+// Around each pixel E:   A B C
+//                        D E F
+//                        G H I
+void Scale2x(const uint32_t *source, uint32_t *out, int first, int last)
+{
+    uint32_t above[VIDEO_WIDTH + 2], row[VIDEO_WIDTH + 2], below[VIDEO_WIDTH + 2];
+    int x, y;
+
+    ScaleAlign(&first, &last);
+    for (y = 0; y < VIDEO_HEIGHT; y++)
+    {
+        uint32_t *top = out + (2 * y) * (2 * VIDEO_WIDTH);
+        uint32_t *bottom = top + 2 * VIDEO_WIDTH;
+
+        ScaleRow(source, y - 1, first, last, above);
+        ScaleRow(source, y, first, last, row);
+        ScaleRow(source, y + 1, first, last, below);
+
+        for (x = first; x < last; x += SCALE_LANES)
+        {
+            ScaleVector b = ScaleLoad(above + x + 1), h = ScaleLoad(below + x + 1);
+            ScaleVector d = ScaleLoad(row + x), e = ScaleLoad(row + x + 1), f = ScaleLoad(row + x + 2);
+            ScaleMask edges = (b != h) & (d != f);
+
+            ScaleVector e0 = ScaleSelect(edges & (d == b), d, e);
+            ScaleVector e1 = ScaleSelect(edges & (b == f), f, e);
+            ScaleVector e2 = ScaleSelect(edges & (d == h), d, e);
+            ScaleVector e3 = ScaleSelect(edges & (h == f), f, e);
+
+            ScaleStore(top + 2 * x, __builtin_shuffle(e0, e1, (ScaleMask){0, 4, 1, 5}));
+            ScaleStore(top + 2 * x + 4, __builtin_shuffle(e0, e1, (ScaleMask){2, 6, 3, 7}));
+            ScaleStore(bottom + 2 * x, __builtin_shuffle(e2, e3, (ScaleMask){0, 4, 1, 5}));
+            ScaleStore(bottom + 2 * x + 4, __builtin_shuffle(e2, e3, (ScaleMask){2, 6, 3, 7}));
+        }
+    }
+}
+
+void Scale3x(const uint32_t *source, uint32_t *out, int first, int last)
+{
+    uint32_t above[VIDEO_WIDTH + 2], row[VIDEO_WIDTH + 2], below[VIDEO_WIDTH + 2];
+    int x, y;
+
+    ScaleAlign(&first, &last);
+    for (y = 0; y < VIDEO_HEIGHT; y++)
+    {
+        uint32_t *top = out + (3 * y) * (3 * VIDEO_WIDTH);
+        uint32_t *middle = top + 3 * VIDEO_WIDTH;
+        uint32_t *bottom = middle + 3 * VIDEO_WIDTH;
+
+        ScaleRow(source, y - 1, first, last, above);
+        ScaleRow(source, y, first, last, row);
+        ScaleRow(source, y + 1, first, last, below);
+
+        for (x = first; x < last; x += SCALE_LANES)
+        {
+            ScaleVector a = ScaleLoad(above + x), b = ScaleLoad(above + x + 1), c = ScaleLoad(above + x + 2);
+            ScaleVector d = ScaleLoad(row + x), e = ScaleLoad(row + x + 1), f = ScaleLoad(row + x + 2);
+            ScaleVector g = ScaleLoad(below + x), h = ScaleLoad(below + x + 1), i = ScaleLoad(below + x + 2);
+            ScaleMask edges = (b != h) & (d != f);
+            ScaleMask db = edges & (d == b), bf = edges & (b == f), dh = edges & (d == h), hf = edges & (h == f);
+
+            ScaleStore3(top + 3 * x, ScaleSelect(db, d, e),
+                        ScaleSelect((db & (e != c)) | (bf & (e != a)), b, e),
+                        ScaleSelect(bf, f, e));
+            ScaleStore3(middle + 3 * x, ScaleSelect((db & (e != g)) | (dh & (e != a)), d, e),
+                        e,
+                        ScaleSelect((bf & (e != i)) | (hf & (e != c)), f, e));
+            ScaleStore3(bottom + 3 * x, ScaleSelect(dh, d, e),
+                        ScaleSelect((dh & (e != i)) | (hf & (e != g)), h, e),
+                        ScaleSelect(hf, f, e));
+        }
+    }
+}
+
+Scaler scalers[] = {
+    {"nearest2", 2, ScaleNearest2},
+    {"nearest3", 3, ScaleNearest3},
+    {"scale2x", 2, Scale2x},
+    {"scale3x", 3, Scale3x},
+};
+
+#define SCALERS (int)(sizeof(scalers) / sizeof(scalers[0]))
+
+// NULL if there's no scaler called name
+const Scaler *ScalerFind(const char *name)
+{
+    int i;
+
+    for (i = 0; i < SCALERS; i++)
+    {
+        if (strcmp(scalers[i].name, name) == 0)
+        {
+            return &scalers[i];
+        }
+    }
+    return NULL;
+}
+
+// The source columns to scale again when *first to *last - 1 changed
+void ScaleWiden(int *first, int *last)
+{
+    if (*first > 0)
+    {
+        (*first)--;
+    }
+    if (*last < VIDEO_WIDTH)
+    {
+        (*last)++;
+    }
+}
@@ -0,0 +1,323 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The sound board: the game turns the sounds on and off with the bits of
+// ports 3 and 5, the board makes them with analog circuits. Here they're made
+// up as square waves and noise with a sweep, a wobble and a fade, close enough
+// to tell them apart and to hear the fleet speed up.
+//
+// Port 3: 0 saucer (on as long as the bit is), 1 shot, 2 player hit,
+//         3 invader hit, 4 extra ship, 5 sound on
+// Port 5: 0-3 the four fleet steps, 4 saucer hit
+//
+// The machine calls SoundLatch on every OUT to those ports, with the cycle it
+// happened at, and the samples up to that cycle are made right then, so a
+// sound starts on the sample that goes with its cycle whatever the frame
+// timing. SoundTake hands over the samples made up to some cycle (usually the
+// end of a frame). The samples only depend on the cycles and the port writes,
+// so the same run gives the same samples however they're taken.
+//
+// SoundRing carries the samples from the emulation thread to the audio
+// callback, a single producer and a single consumer with no lock. Its size is
+// the most latency there can be: samples that don't fit are dropped, and the
+// callback plays silence when there aren't enough, both counted.
+//
+//   SoundInit(&sound, 48000, state->cycles);
+//   MachineDeviceOf(state)->sound = &sound;
+//   n = SoundTake(&sound, state->cycles, &samples);   // every frame
+
+#define SOUND_RATE 48000
+
+// made and not taken yet, a good part of a second
+#define SOUND_PENDING 16384
+
+typedef struct SoundEffect
+{
+    uint8_t port, bit;
+    int ms;
+    int start_hz, end_hz;       // swept over the length
+    int wobble_hz, wobble_hz_depth;
+    int noise;                  // out of 256, the rest is the square wave
+    int volume;
+    int held;                   // plays as long as the bit is on, the sweep over and over
+} SoundEffect;
+
+static const SoundEffect sound_effects[] = {
+    {3, 0x01, 200, 480, 480, 6, 160, 0, 2500, TRUE},    // saucer
+    {3, 0x02, 250, 1400, 250, 0, 0, 64, 3000, FALSE},   // shot
+    {3, 0x04, 1000, 90, 40, 0, 0, 224, 6000, FALSE},    // player hit
+    {3, 0x08, 300, 600, 100, 0, 0, 160, 4000, FALSE},   // invader hit
+    {3, 0x10, 600, 1000, 1000, 8, 300, 0, 2500, FALSE}, // extra ship
+    {5, 0x01, 90, 110, 90, 0, 0, 0, 5000, FALSE},       // fleet steps, low to lower
+    {5, 0x02, 90, 98, 80, 0, 0, 0, 5000, FALSE},
+    {5, 0x04, 90, 87, 72, 0, 0, 0, 5000, FALSE},
+    {5, 0x08, 90, 82, 66, 0, 0, 0, 5000, FALSE},
+    {5, 0x10, 1000, 900, 300, 12, 250, 0, 3000, FALSE}, // saucer hit
+};
+
+#define SOUND_EFFECTS (int)(sizeof(sound_effects) / sizeof(sound_effects[0]))
+
+// bit 5 of port 3
+#define SOUND_ENABLE 0x20
+
+typedef struct SoundVoice
+{
+    int active;
+    uint32_t t;      // samples since it started
+    uint32_t length; // in samples
+    uint32_t phase, wobble_phase;
+} SoundVoice;
+
+typedef struct Sound
+{
+    int rate;
+    uint8_t port[6]; // the last values written to 3 and 5
+    SoundVoice voices[SOUND_EFFECTS];
+    uint16_t noise;     // LFSR
+    uint32_t cycles;    // samples made up to here
+    uint64_t remainder; // cycles * rate short of a whole sample
+    int16_t pending[SOUND_PENDING];
+    int count;
+    long dropped; // made while pending was full
+} Sound;
+
+void SoundInit(Sound *sound, int rate, uint32_t cycles)
+{
+    memset(sound, 0, sizeof(*sound));
+    sound->rate = rate;
+    sound->noise = 0xace1;
+    sound->cycles = cycles;
+}
+
+// Starts again from cycles without making the samples in between (after the
+// machine ran without sound, fast-forwarding)
+void SoundSync(Sound *sound, uint32_t cycles)
+{
+    sound->cycles = cycles;
+    sound->remainder = 0;
+    sound->count = 0;
+}
+
+static int16_t SoundSample(Sound *sound)
+{
+    int32_t mix = 0;
+    int i;
+
+    sound->noise = (sound->noise >> 1) ^ (-(sound->noise & 1) & 0xb400);
+    for (i = 0; i < SOUND_EFFECTS; i++)
+    {
+        const SoundEffect *effect = &sound_effects[i];
+        SoundVoice *voice = &sound->voices[i];
+
+        if (!voice->active)
+        {
+            continue;
+        }
+
+        int64_t hz = effect->start_hz + (int64_t)(effect->end_hz - effect->start_hz) * voice->t / voice->length;
+        if (effect->wobble_hz)
+        {
+            // triangle, 0 to 65535 and back
+            uint32_t up = (voice->wobble_phase >> 15) & 0xffff;
+            uint32_t triangle = (voice->wobble_phase >> 31) ? 0xffff - up : up;
+
+            hz += ((int64_t)triangle * effect->wobble_hz_depth >> 16) - effect->wobble_hz_depth / 2;
+            voice->wobble_phase += (uint32_t)(((uint64_t)effect->wobble_hz << 32) / sound->rate);
+        }
+        voice->phase += (uint32_t)(((uint64_t)hz << 32) / sound->rate);
+
+        int32_t square = (voice->phase >> 31) ? effect->volume : -effect->volume;
+        int32_t noise = (sound->noise & 1) ? effect->volume : -effect->volume;
+        int32_t sample = (square * (256 - effect->noise) + noise * effect->noise) >> 8;
+
+        if (!effect->held)
+        {
+            sample = (int32_t)(sample * (int64_t)(voice->length - voice->t) / voice->length);
+        }
+        mix += sample;
+
+        if (++voice->t == voice->length)
+        {
+            voice->t = 0;
+            voice->active = effect->held;
+        }
+    }
+
+    if (!(sound->port[3] & SOUND_ENABLE))
+    {
+        return 0;
+    }
+    return (int16_t)(mix > 32767 ? 32767 : mix < -32768 ? -32768 : mix);
+}
+
+// Makes the samples from where it got to up to cycles
+void SoundRender(Sound *sound, uint32_t cycles)
+{
+    uint64_t due = (uint64_t)(uint32_t)(cycles - sound->cycles) * sound->rate + sound->remainder;
+    uint64_t samples = due / CPU_HZ;
+
+    sound->remainder = due % CPU_HZ;
+    sound->cycles = cycles;
+    while (samples--)
+    {
+        int16_t sample = SoundSample(sound);
+
+        if (sound->count < SOUND_PENDING)
+        {
+            sound->pending[sound->count++] = sample;
+        }
+        else
+        {
+            sound->dropped++;
+        }
+    }
+}
+
+// For the machine's OUT, at cycles
+void SoundLatch(Sound *sound, uint32_t cycles, uint8_t port, uint8_t value)
+{
+    int i;
+
+    if ((port != 3 && port != 5) || sound->port[port] == value)
+    {
+        return;
+    }
+
+    SoundRender(sound, cycles);
+    for (i = 0; i < SOUND_EFFECTS; i++)
+    {
+        const SoundEffect *effect = &sound_effects[i];
+        SoundVoice *voice = &sound->voices[i];
+        uint8_t bit = effect->bit;
+
+        if (effect->port != port)
+        {
+            continue;
+        }
+        if ((value & bit) && !(sound->port[port] & bit))
+        {
+            voice->active = TRUE;
+            voice->t = 0;
+            voice->length = (uint32_t)((int64_t)effect->ms * sound->rate / 1000);
+        }
+        else if (effect->held && !(value & bit))
+        {
+            voice->active = FALSE;
+        }
+    }
+    sound->port[port] = value;
+}
+
+// Makes the samples up to cycles and hands over all those not taken yet, in
+// *samples until the next call. Returns how many
+int SoundTake(Sound *sound, uint32_t cycles, const int16_t **samples)
+{
+    int count;
+
+    SoundRender(sound, cycles);
+    count = sound->count;
+    sound->count = 0;
+    *samples = sound->pending;
+    return count;
+}
+
+typedef struct SoundRing
+{
+    int16_t *samples;
+    uint32_t size;  // a power of two
+    uint32_t limit; // most samples it holds, the latency
+    _Atomic uint32_t head; // written, producer side
+    _Atomic uint32_t tail; // read, consumer side
+    _Atomic int started;   // no underruns before the first samples came
+    _Atomic long underruns; // callbacks that got short
+    _Atomic long silence;   // samples of silence they played instead
+    long overruns;          // samples dropped by the producer
+} SoundRing;
+
+// Holds up to capacity samples. Returns FALSE if it can't be allocated
+int SoundRingInit(SoundRing *ring, int capacity)
+{
+    ring->limit = capacity;
+    ring->size = 1;
+    while (ring->size < (uint32_t)capacity)
+    {
+        ring->size <<= 1;
+    }
+    ring->samples = (int16_t *)calloc(ring->size, sizeof(int16_t));
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    atomic_store(&ring->started, FALSE);
+    atomic_store(&ring->underruns, 0);
+    atomic_store(&ring->silence, 0);
+    ring->overruns = 0;
+    return ring->samples != NULL;
+}
+
+void SoundRingRelease(SoundRing *ring)
+{
+    free(ring->samples);
+    ring->samples = NULL;
+}
+
+// Producer side, never waits
+void SoundRingPush(SoundRing *ring, const int16_t *samples, int count)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t room = ring->limit - (head - atomic_load_explicit(&ring->tail, memory_order_acquire));
+    int i;
+
+    if ((uint32_t)count > room)
+    {
+        ring->overruns += count - room;
+        count = room;
+    }
+    for (i = 0; i < count; i++)
+    {
+        ring->samples[(head + i) & (ring->size - 1)] = samples[i];
+    }
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+    if (count)
+    {
+        atomic_store_explicit(&ring->started, TRUE, memory_order_relaxed);
+    }
+}
+
+// Producer side, how many samples are waiting to be played
+uint32_t SoundRingQueued(SoundRing *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_relaxed) -
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+// Producer side, with the consumer stopped (a paused device): drops what's
+// left, and no underruns until samples come again
+void SoundRingRestart(SoundRing *ring)
+{
+    atomic_store(&ring->tail, atomic_load(&ring->head));
+    atomic_store(&ring->started, FALSE);
+}
+
+// Consumer side (the audio callback), always fills out
+void SoundRingPop(SoundRing *ring, int16_t *out, int count)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t ready = atomic_load_explicit(&ring->head, memory_order_acquire) - tail;
+    int i, got = (uint32_t)count < ready ? count : (int)ready;
+
+    for (i = 0; i < got; i++)
+    {
+        out[i] = ring->samples[(tail + i) & (ring->size - 1)];
+    }
+    atomic_store_explicit(&ring->tail, tail + got, memory_order_release);
+
+    if (got < count)
+    {
+        memset(out + got, 0, (count - got) * sizeof(int16_t));
+        if (atomic_load_explicit(&ring->started, memory_order_relaxed))
+        {
+            atomic_fetch_add_explicit(&ring->underruns, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&ring->silence, count - got, memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,94 @@
+// Tail-call threaded interpreter: every opcode has its own handler, and each
+// handler ends by jumping straight into the handler of the next opcode, so
+// there is no loop and no central switch, and every opcode gets its own
+// indirect branch to predict. With clang (and gcc 15+) the jump is forced with
+// musttail, older gcc makes it a jump anyway when it optimizes sibling calls
+// since all the handlers have the same signature (see THREADED_SIBCALL).
+// The handlers are the Execute8080 cases with a constant opcode, like fuse.c,
+// so the 8080 registers stay in State8080; what travels in host registers is
+// the state pointer, the deadline and the instruction count.
+
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+#ifndef MUSTTAIL
+// without musttail the jumps are only there when gcc optimizes sibling calls,
+// which -O0 never does: every instruction of a half frame would then be a call
+// frame on the stack, so refuse to build rather than overflow it
+#ifndef __OPTIMIZE__
+#error "THREADED_CORE needs a compiler with musttail, or an optimized build (-O1 and up)"
+#endif
+#define MUSTTAIL
+#define THREADED_SIBCALL __attribute__((optimize("optimize-sibling-calls")))
+#else
+#define THREADED_SIBCALL
+#endif
+
+typedef int (*ThreadedHandler)(State8080 *state, uint64_t deadline, int ran);
+
+extern const ThreadedHandler threaded_handlers[256];
+
+#define THREADED_OP(op)                                                        \
+    THREADED_SIBCALL static int Threaded_##op(State8080 *state, uint64_t deadline, int ran) \
+    {                                                                          \
+        state->pc += Execute8080(state, op);                                   \
+        ran++;                                                                 \
+        if ((int)(state->cycles - deadline) >= 0)                              \
+        {                                                                      \
+            return ran;                                                        \
+        }                                                                      \
+        MUSTTAIL return threaded_handlers[state->memory[state->pc]](state, deadline, ran); \
+    }
+
+#define THREADED_ROW(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p) \
+    THREADED_OP(a) THREADED_OP(b) THREADED_OP(c) THREADED_OP(d)     \
+    THREADED_OP(e) THREADED_OP(f) THREADED_OP(g) THREADED_OP(h)     \
+    THREADED_OP(i) THREADED_OP(j) THREADED_OP(k) THREADED_OP(l)     \
+    THREADED_OP(m) THREADED_OP(n) THREADED_OP(o) THREADED_OP(p)
+
+#define THREADED_OPCODES \
+    THREADED_ROW(0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f) \
+    THREADED_ROW(0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f) \
+    THREADED_ROW(0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f) \
+    THREADED_ROW(0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f) \
+    THREADED_ROW(0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f) \
+    THREADED_ROW(0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f) \
+    THREADED_ROW(0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f) \
+    THREADED_ROW(0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d, 0x7e, 0x7f) \
+    THREADED_ROW(0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f) \
+    THREADED_ROW(0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f) \
+    THREADED_ROW(0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf) \
+    THREADED_ROW(0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf) \
+    THREADED_ROW(0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf) \
+    THREADED_ROW(0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf) \
+    THREADED_ROW(0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef) \
+    THREADED_ROW(0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff)
+
+THREADED_OPCODES
+
+#undef THREADED_OP
+#undef THREADED_ROW
+
+// and the table they jump through
+#define THREADED_OP(op) Threaded_##op,
+#define THREADED_ROW(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p) \
+    THREADED_OP(a) THREADED_OP(b) THREADED_OP(c) THREADED_OP(d)     \
+    THREADED_OP(e) THREADED_OP(f) THREADED_OP(g) THREADED_OP(h)     \
+    THREADED_OP(i) THREADED_OP(j) THREADED_OP(k) THREADED_OP(l)     \
+    THREADED_OP(m) THREADED_OP(n) THREADED_OP(o) THREADED_OP(p)
+
+const ThreadedHandler threaded_handlers[256] = {
+    THREADED_OPCODES
+};
+
+#undef THREADED_OP
+#undef THREADED_ROW
+
+// Runs from PC until the cycle count reaches deadline (which must be set).
+// Returns the number of instructions executed
+int RunThreaded(State8080 *state, uint64_t deadline)
+{
+    return threaded_handlers[state->memory[state->pc]](state, deadline, 0);
+}
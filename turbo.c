@@ -0,0 +1,109 @@
+// Fast-forward: while it's on the machine runs unthrottled and only every Nth
+// frame is drawn. N follows how long a whole pass (N frames, then drawing and
+// presenting one) takes against the display's refresh interval: it grows while
+// a pass fits in about one refresh and shrinks when passes start missing them,
+// so the screen is still updated at the refresh rate and all the time in
+// between goes to the machine, whatever presenting costs on this host.
+//
+//   Turbo turbo;
+//   TurboInit(&turbo, refresh_hz);
+//   ... run turbo.frames frames, draw, present ...
+//   TurboAdapt(&turbo, nanoseconds the pass took);
+//   if (TurboMeasure(&turbo, frames run so far)) ... show turbo.speed ...
+
+// never more frames than this per shown one
+#define TURBO_MAX_FRAMES 2000
+
+// passes in a row below the ceiling before trying it again
+#define TURBO_PROBE_PASSES 64
+
+// the speed is measured over windows this long
+#define TURBO_WINDOW_NS 500000000
+
+typedef struct Turbo
+{
+    int on;
+    int frames;           // N, frames run per frame shown
+    long long refresh_ns; // the display's refresh interval
+    int ceiling;          // the last N that missed a refresh
+    int fits;             // passes in a row that didn't
+
+    // the speed: frames run over the last window, as a multiple of real time
+    long long window_start;
+    unsigned int window_frames;
+    double speed;
+} Turbo;
+
+void TurboInit(Turbo *turbo, int refresh_hz)
+{
+    memset(turbo, 0, sizeof(Turbo));
+    turbo->frames = 1;
+    turbo->ceiling = TURBO_MAX_FRAMES + 1;
+    turbo->refresh_ns = 1000000000LL / (refresh_hz > 0 ? refresh_hz : 60);
+    turbo->window_start = PacerNow();
+    turbo->speed = 1;
+}
+
+void TurboToggle(Turbo *turbo)
+{
+    turbo->on = !turbo->on;
+    turbo->frames = 1;
+    turbo->ceiling = TURBO_MAX_FRAMES + 1;
+    turbo->fits = 0;
+}
+
+// Picks N for the next pass from how long the last one took
+void TurboAdapt(Turbo *turbo, long long pass_ns)
+{
+    if (pass_ns < turbo->refresh_ns * 9 / 8)
+    {
+        // fits in a refresh (with vsync a pass takes just about one anyway):
+        // more, up to just under what last missed, and that again once in a
+        // while in case the host got faster
+        turbo->frames += turbo->frames / 16 + 1;
+        if (turbo->frames >= turbo->ceiling)
+        {
+            turbo->frames = turbo->ceiling - 1;
+            if (++turbo->fits >= TURBO_PROBE_PASSES)
+            {
+                // as fast as N grows: the miss may only have been the
+                // host busy with something else for a moment
+                turbo->ceiling += turbo->ceiling / 16 + 1;
+                turbo->fits = 0;
+            }
+        }
+    }
+    else if (pass_ns > turbo->refresh_ns * 3 / 2)
+    {
+        // missed one
+        turbo->ceiling = turbo->frames;
+        turbo->fits = 0;
+        turbo->frames -= turbo->frames / 8 + 1;
+    }
+
+    if (turbo->frames < 1)
+    {
+        turbo->frames = 1;
+    }
+    if (turbo->frames > TURBO_MAX_FRAMES)
+    {
+        turbo->frames = TURBO_MAX_FRAMES;
+    }
+}
+
+// Takes the number of frames run so far. TRUE when a window is over and
+// turbo->speed was updated
+int TurboMeasure(Turbo *turbo, unsigned int frames)
+{
+    long long now = PacerNow();
+
+    if (now - turbo->window_start < TURBO_WINDOW_NS)
+    {
+        return FALSE;
+    }
+
+    turbo->speed = (frames - turbo->window_frames) / FRAMES_PER_SECOND / ((now - turbo->window_start) / 1e9);
+    turbo->window_start = now;
+    turbo->window_frames = frames;
+    return TRUE;
+}
@@ -0,0 +1,271 @@
+#include <stdatomic.h>
+#include <string.h>
+
+// Frames from the emulation thread to the render thread.
+//
+// TripleBuffer: the emulation side always has a frame of its own to fill
+// (back), the render side one of its own to show (front), and the third one
+// (middle) is swapped with an atomic exchange: publishing puts the finished
+// back frame in the middle and takes the old middle as the next back, taking
+// the newest puts front in the middle if a fresh one is there. Neither side
+// ever waits for the other; frames the render side didn't get to in time are
+// simply replaced by newer ones.
+//
+// Dirty columns: a bit for each video RAM column (32 bytes, a column of the
+// screen as it's shown) that was written since the frame on screen, set by
+// VideoWriteHook (the machine's write_hook), so that only those columns get
+// converted and uploaded again. A frame in the triple buffer carries the ones
+// changed since the last frame the render side took.
+//
+// Histogram is for the timings around it (emulation jitter, frame latency).
+
+#define VIDEO_WIDTH 224
+#define VIDEO_HEIGHT 256
+
+#include "overlay.c"
+
+// in TripleBuffer.middle, next to the index: the frame there wasn't taken yet
+#define VIDEO_FRESH 4
+
+// a bit per column
+#define VIDEO_DIRTY_WORDS (VIDEO_WIDTH / 32)
+
+typedef struct VideoFrame
+{
+    uint32_t number;
+    uint64_t published; // host clock at VBlank, for the latency
+    uint8_t playing;    // a game going on (not attract mode), for DirtyStats
+    uint32_t dirty[VIDEO_DIRTY_WORDS];
+    uint8_t vram[0x1c00];
+} VideoFrame;
+
+typedef struct TripleBuffer
+{
+    VideoFrame frames[3];
+    _Atomic int middle; // index | VIDEO_FRESH
+    int back;           // emulation side only
+    int front;          // render side only
+} TripleBuffer;
+
+void TripleBufferInit(TripleBuffer *buffer)
+{
+    memset(buffer->frames, 0, sizeof(buffer->frames));
+    buffer->back = 0;
+    atomic_store(&buffer->middle, 1);
+    buffer->front = 2;
+}
+
+// The frame to fill next, emulation side
+VideoFrame *TripleBufferBack(TripleBuffer *buffer)
+{
+    return &buffer->frames[buffer->back];
+}
+
+// Hands the back frame over as the newest one. Returns TRUE if the render side
+// took the one it replaces
+int TripleBufferPublish(TripleBuffer *buffer)
+{
+    int replaced = atomic_exchange_explicit(&buffer->middle, buffer->back | VIDEO_FRESH, memory_order_acq_rel);
+
+    buffer->back = replaced & 3;
+    return (replaced & VIDEO_FRESH) == 0;
+}
+
+// TRUE once the render side took the last frame published, emulation side
+int TripleBufferTaken(TripleBuffer *buffer)
+{
+    return (atomic_load_explicit(&buffer->middle, memory_order_relaxed) & VIDEO_FRESH) == 0;
+}
+
+// The newest frame, render side. fresh is set if it wasn't returned before
+VideoFrame *TripleBufferNewest(TripleBuffer *buffer, int *fresh)
+{
+    *fresh = (atomic_load_explicit(&buffer->middle, memory_order_relaxed) & VIDEO_FRESH) != 0;
+    if (*fresh)
+    {
+        buffer->front = atomic_exchange_explicit(&buffer->middle, buffer->front, memory_order_acq_rel) & 3;
+    }
+    return &buffer->frames[buffer->front];
+}
+
+// columns written since VideoTakeDirty, all of them to begin with
+MACHINE_LOCAL uint32_t video_dirty[VIDEO_DIRTY_WORDS] = {~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u};
+
+// For state->write_hook
+void VideoWriteHook(State8080 *state, uint16_t address, uint16_t length)
+{
+    int first = address - 0x2400, last = address + length - 1 - 0x2400;
+    int x;
+
+    if (last < 0 || first >= 0x1c00)
+    {
+        return;
+    }
+    first = (first < 0) ? 0 : first >> 5;
+    last = (last >= 0x1c00) ? VIDEO_WIDTH - 1 : last >> 5;
+    for (x = first; x <= last; x++)
+    {
+        video_dirty[x >> 5] |= 1u << (x & 31);
+    }
+}
+
+// Everything gets converted again, for when what's on screen doesn't follow
+// from the writes (run-ahead turned on or off...)
+void VideoDirtyAll()
+{
+    memset(video_dirty, 0xff, sizeof(video_dirty));
+}
+
+// Copies the dirty columns so far into dirty and starts over
+void VideoTakeDirty(uint32_t *dirty)
+{
+    memcpy(dirty, video_dirty, sizeof(video_dirty));
+    memset(video_dirty, 0, sizeof(video_dirty));
+}
+
+int VideoDirtyCount(const uint32_t *dirty)
+{
+    int count = 0, word;
+
+    for (word = 0; word < VIDEO_DIRTY_WORDS; word++)
+    {
+        count += __builtin_popcount(dirty[word]);
+    }
+    return count;
+}
+
+// From column *x on, finds the next run of dirty columns: moves *x to its
+// start and returns how many there are, 0 when there's none left
+int VideoDirtyRun(const uint32_t *dirty, int *x)
+{
+    int start = *x, end;
+
+    while (start < VIDEO_WIDTH && !((dirty[start >> 5] >> (start & 31)) & 1))
+    {
+        start++;
+    }
+    end = start;
+    while (end < VIDEO_WIDTH && ((dirty[end >> 5] >> (end & 31)) & 1))
+    {
+        end++;
+    }
+    *x = start;
+    return end - start;
+}
+
+// Column x of the video RAM as ARGB pixels, the right way up, lit ones in the
+// overlay's colors (all white for OverlayMonochrome, same cost either way)
+void VideoDrawColumn(const uint8_t *vram, uint32_t *pixels, const Overlay *overlay, int x)
+{
+    const uint8_t *column = vram + x * 32;
+    const uint32_t *colors = overlay->column[x];
+    uint32_t *out = pixels + (VIDEO_HEIGHT - 1) * VIDEO_WIDTH + x;
+    int y;
+
+    for (y = 0; y < VIDEO_HEIGHT; y++, out -= VIDEO_WIDTH)
+    {
+        uint32_t lit = -(uint32_t)((column[y >> 3] >> (y & 7)) & 1);
+        *out = 0xff000000 | (colors[y] & lit);
+    }
+}
+
+// The video RAM as VIDEO_WIDTH x VIDEO_HEIGHT ARGB pixels
+void VideoDraw(const uint8_t *vram, uint32_t *pixels, const Overlay *overlay)
+{
+    int x;
+
+    for (x = 0; x < VIDEO_WIDTH; x++)
+    {
+        VideoDrawColumn(vram, pixels, overlay, x);
+    }
+}
+
+// Only the dirty columns
+void VideoDrawDirty(const uint8_t *vram, uint32_t *pixels, const Overlay *overlay, const uint32_t *dirty)
+{
+    int x = 0, width;
+
+    while ((width = VideoDirtyRun(dirty, &x)) > 0)
+    {
+        while (width--)
+        {
+            VideoDrawColumn(vram, pixels, overlay, x++);
+        }
+    }
+}
+
+// How much of the screen gets converted per frame drawn, in attract mode and
+// during a game
+typedef struct DirtyStats
+{
+    unsigned long long frames[2];
+    unsigned long long columns[2];
+} DirtyStats;
+
+void DirtyStatsAdd(DirtyStats *stats, const uint32_t *dirty, int playing)
+{
+    stats->frames[playing != 0]++;
+    stats->columns[playing != 0] += VideoDirtyCount(dirty);
+}
+
+void DirtyStatsPrint(DirtyStats *stats)
+{
+    const char *name[2] = {"attract mode", "game"};
+    int playing;
+
+    for (playing = 0; playing < 2; playing++)
+    {
+        if (stats->frames[playing])
+        {
+            printf("Converted in %s: %.1f%% of the screen per frame (%.1f of %d columns, %llu frames)\n", name[playing],
+                   100.0 * stats->columns[playing] / stats->frames[playing] / VIDEO_WIDTH,
+                   (double)stats->columns[playing] / stats->frames[playing], VIDEO_WIDTH, stats->frames[playing]);
+        }
+    }
+}
+
+// 1 ms buckets, the last one for anything longer
+#define HISTOGRAM_BUCKETS 34
+
+typedef struct Histogram
+{
+    const char *name;
+    unsigned long long count[HISTOGRAM_BUCKETS];
+    unsigned long long samples;
+    double total;
+    double max;
+} Histogram;
+
+void HistogramAdd(Histogram *histogram, double ms)
+{
+    int bucket = (ms < 0) ? 0 : (int)ms;
+
+    histogram->count[bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1]++;
+    histogram->samples++;
+    histogram->total += ms;
+    if (ms > histogram->max)
+    {
+        histogram->max = ms;
+    }
+}
+
+void HistogramPrint(Histogram *histogram)
+{
+    int bucket;
+
+    if (histogram->samples == 0)
+    {
+        return;
+    }
+
+    printf("%s: %llu samples, mean %.2f ms, max %.2f ms\n", histogram->name, histogram->samples,
+           histogram->total / histogram->samples, histogram->max);
+    for (bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+    {
+        if (histogram->count[bucket])
+        {
+            printf("  %s%2d ms %8llu  %5.1f%%\n", (bucket == HISTOGRAM_BUCKETS - 1) ? ">=" : "  ", bucket,
+                   histogram->count[bucket], 100.0 * histogram->count[bucket] / histogram->samples);
+        }
+    }
+}
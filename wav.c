@@ -0,0 +1,84 @@
+#include <stdio.h>
+
+// Writes 16-bit mono PCM WAV files, for the sound (sound.c) of headless runs.
+// The sizes in the header are filled in by WavClose.
+//
+//   Wav wav;
+//   WavOpen(&wav, "run.wav", 48000);
+//   WavWrite(&wav, samples, count);
+//   WavClose(&wav);
+
+typedef struct Wav
+{
+    FILE *fp;
+    int rate;
+    long samples;
+} Wav;
+
+static void WavPut(FILE *fp, uint32_t value, int bytes)
+{
+    while (bytes--)
+    {
+        fputc(value & 0xff, fp);
+        value >>= 8;
+    }
+}
+
+static void WavHeader(Wav *wav)
+{
+    int rate = wav->rate;
+    uint32_t data = (uint32_t)wav->samples * 2;
+
+    fwrite("RIFF", 4, 1, wav->fp);
+    WavPut(wav->fp, 36 + data, 4);
+    fwrite("WAVEfmt ", 8, 1, wav->fp);
+    WavPut(wav->fp, 16, 4);       // fmt size
+    WavPut(wav->fp, 1, 2);        // PCM
+    WavPut(wav->fp, 1, 2);        // mono
+    WavPut(wav->fp, rate, 4);
+    WavPut(wav->fp, rate * 2, 4); // bytes per second
+    WavPut(wav->fp, 2, 2);        // bytes per sample
+    WavPut(wav->fp, 16, 2);       // bits
+    fwrite("data", 4, 1, wav->fp);
+    WavPut(wav->fp, data, 4);
+}
+
+// Returns FALSE if path can't be written
+int WavOpen(Wav *wav, const char *path, int rate)
+{
+    wav->fp = fopen(path, "wb");
+    wav->rate = rate;
+    wav->samples = 0;
+    if (wav->fp == NULL)
+    {
+        return FALSE;
+    }
+    WavHeader(wav);
+    return TRUE;
+}
+
+// little-endian whatever the host is, a buffer at a time
+void WavWrite(Wav *wav, const int16_t *samples, int count)
+{
+    uint8_t bytes[4096];
+    int i, n = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        bytes[n++] = (uint16_t)samples[i] & 0xff;
+        bytes[n++] = (uint16_t)samples[i] >> 8;
+        if (n == sizeof(bytes) || i == count - 1)
+        {
+            fwrite(bytes, n, 1, wav->fp);
+            n = 0;
+        }
+    }
+    wav->samples += count;
+}
+
+void WavClose(Wav *wav)
+{
+    fseek(wav->fp, 0, SEEK_SET);
+    WavHeader(wav);
+    fclose(wav->fp);
+}